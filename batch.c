@@ -0,0 +1,406 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Batched legal move counting, i.e. perft to depth 1 over many positions at once, for bulk
+// workloads such as shallow perfts over a position database.
+//
+// Rather than generating and checking each move, we count them set-wise. Each pawn, knight and
+// slider move is the only one of its piece type to reach its target along its direction - a
+// slider's ray stops at the first piece, including a friendly slider behind which the next ray
+// starts - so the popcounts of the per-direction target sets sum to the number of moves.
+// Positions are flipped so the side to move is always white, which lets the AVX2 kernel count
+// BATCH_LANES positions at once, one per lane.
+
+#include "weak.h"
+#include "magic.h"
+
+#if defined(USE_AVX2) && defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_AVX2_BATCH
+#include <immintrin.h>
+#endif
+
+#define BATCH_LANES 4
+
+#define NOT_FILE_AB_MASK (NotFileAMask & NotFileBMask)
+#define NOT_FILE_GH_MASK (NotFileGMask & NotFileHMask)
+
+// The pieces of up to BATCH_LANES positions which are counted set-wise, flipped so the side to
+// move is white. Pinned pieces, the king and castling are counted separately.
+typedef struct BatchLanes BatchLanes;
+struct BatchLanes {
+  BitBoard Pawns[BATCH_LANES], Knights[BATCH_LANES];
+  BitBoard Rookish[BATCH_LANES], Bishopish[BATCH_LANES];
+  // Empty squares, squares not occupied by the side to move, and its opponent's pieces.
+  BitBoard Empty[BATCH_LANES], Targets[BATCH_LANES], Enemy[BATCH_LANES];
+};
+
+static bool useAvx2;
+
+#if defined(HAVE_AVX2_BATCH)
+static void avx2CountLanes(BatchLanes*, uint32_t*);
+#endif
+static void                  countLanes(BatchLanes*, int, uint32_t*);
+static uint32_t              countPawns(BitBoard, BitBoard, BitBoard, BitBoard);
+static uint32_t              countPinned(Game*, BitBoard);
+static FORCE_INLINE BitBoard flip(BitBoard, Side);
+static FORCE_INLINE BitBoard lineThrough(Position, Position);
+static bool                  prepareLane(Game*, BatchLanes*, int, uint32_t*);
+
+// Count the legal moves in each of n positions, i.e. their perft to depth 1, into out.
+void
+CountMovesBatch(Game **games, int n, uint32_t *out)
+{
+  BatchLanes lanes;
+  int i, j, lane = 0;
+  int indices[BATCH_LANES];
+  uint32_t counts[BATCH_LANES];
+
+  for(i = 0; i < n; i++) {
+    if(!prepareLane(games[i], &lanes, lane, &out[i])) {
+      continue;
+    }
+
+    indices[lane++] = i;
+    if(lane == BATCH_LANES) {
+      countLanes(&lanes, lane, counts);
+      for(j = 0; j < lane; j++) {
+        out[indices[j]] += counts[j];
+      }
+      lane = 0;
+    }
+  }
+
+  // Count any partly filled batch.
+  if(lane > 0) {
+    countLanes(&lanes, lane, counts);
+    for(j = 0; j < lane; j++) {
+      out[indices[j]] += counts[j];
+    }
+  }
+}
+
+// Determine which kernel CountMovesBatch() uses. Set vectorise to use the AVX2 kernel where this
+// build and the processor support it. Returns whether it is in use.
+bool
+InitCountMovesBatch(bool vectorise)
+{
+#if defined(HAVE_AVX2_BATCH)
+  useAvx2 = vectorise && CpuHasAvx2();
+#else
+  (void)vectorise;
+  useAvx2 = false;
+#endif
+
+  return useAvx2;
+}
+
+#if defined(HAVE_AVX2_BATCH)
+// Per lane popcounts of the specified vector, as byte counts. Sum these before reducing them with
+// _mm256_sad_epu8(), as long as no byte can exceed 255.
+__attribute__((target("avx2")))
+static FORCE_INLINE __m256i
+avx2ByteCounts(__m256i vec)
+{
+  __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  __m256i nibbles = _mm256_set1_epi8(0x0f);
+
+  return _mm256_add_epi8(_mm256_shuffle_epi8(lookup, _mm256_and_si256(vec, nibbles)),
+                         _mm256_shuffle_epi8(lookup,
+                                             _mm256_and_si256(_mm256_srli_epi64(vec, 4), nibbles)));
+}
+
+// As FillAttacksDown(), for each lane.
+__attribute__((target("avx2")))
+static FORCE_INLINE __m256i
+avx2FillDown(__m256i gen, __m256i empty, int shift, __m256i wrap)
+{
+  __m256i pro = _mm256_and_si256(empty, wrap);
+
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srli_epi64(gen, shift)));
+  pro = _mm256_and_si256(pro, _mm256_srli_epi64(pro, shift));
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srli_epi64(gen, 2*shift)));
+  pro = _mm256_and_si256(pro, _mm256_srli_epi64(pro, 2*shift));
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srli_epi64(gen, 4*shift)));
+
+  return _mm256_and_si256(_mm256_srli_epi64(gen, shift), wrap);
+}
+
+// As FillAttacksUp(), for each lane.
+__attribute__((target("avx2")))
+static FORCE_INLINE __m256i
+avx2FillUp(__m256i gen, __m256i empty, int shift, __m256i wrap)
+{
+  __m256i pro = _mm256_and_si256(empty, wrap);
+
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_slli_epi64(gen, shift)));
+  pro = _mm256_and_si256(pro, _mm256_slli_epi64(pro, shift));
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_slli_epi64(gen, 2*shift)));
+  pro = _mm256_and_si256(pro, _mm256_slli_epi64(pro, 2*shift));
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_slli_epi64(gen, 4*shift)));
+
+  return _mm256_and_si256(_mm256_slli_epi64(gen, shift), wrap);
+}
+
+// As countLanes(), BATCH_LANES at a time. Unused lanes must be empty.
+__attribute__((target("avx2")))
+static void
+avx2CountLanes(BatchLanes *lanes, uint32_t *counts)
+{
+  __m256i bishopish, bytes, east, empty, enemy, knights, pawns, promotions, push, rookish;
+  __m256i targets, total, west;
+  __m256i all = _mm256_set1_epi64x(FullyOccupied);
+  __m256i notA = _mm256_set1_epi64x(NotFileAMask), notH = _mm256_set1_epi64x(NotFileHMask);
+  __m256i notAB = _mm256_set1_epi64x(NOT_FILE_AB_MASK);
+  __m256i notGH = _mm256_set1_epi64x(NOT_FILE_GH_MASK);
+  __m256i rank3 = _mm256_set1_epi64x(Rank3Mask), rank8 = _mm256_set1_epi64x(Rank8Mask);
+  uint64_t totals[BATCH_LANES];
+  int i;
+
+  pawns = _mm256_loadu_si256((__m256i*)lanes->Pawns);
+  knights = _mm256_loadu_si256((__m256i*)lanes->Knights);
+  rookish = _mm256_loadu_si256((__m256i*)lanes->Rookish);
+  bishopish = _mm256_loadu_si256((__m256i*)lanes->Bishopish);
+  empty = _mm256_loadu_si256((__m256i*)lanes->Empty);
+  targets = _mm256_loadu_si256((__m256i*)lanes->Targets);
+  enemy = _mm256_loadu_si256((__m256i*)lanes->Enemy);
+
+  // Pawns, as countPawns(). Each of the 4 promotions counts as a move.
+  push = _mm256_and_si256(_mm256_slli_epi64(pawns, 8), empty);
+  west = _mm256_and_si256(_mm256_and_si256(_mm256_slli_epi64(pawns, 7), notH), enemy);
+  east = _mm256_and_si256(_mm256_and_si256(_mm256_slli_epi64(pawns, 9), notA), enemy);
+  bytes = avx2ByteCounts(_mm256_and_si256(_mm256_slli_epi64(_mm256_and_si256(push, rank3), 8),
+                                          empty));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(push));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(west));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(east));
+  // Promotions are already counted once.
+  promotions = avx2ByteCounts(_mm256_and_si256(push, rank8));
+  promotions = _mm256_add_epi8(promotions, avx2ByteCounts(_mm256_and_si256(west, rank8)));
+  promotions = _mm256_add_epi8(promotions, avx2ByteCounts(_mm256_and_si256(east, rank8)));
+  bytes = _mm256_add_epi8(bytes, _mm256_add_epi8(promotions,
+                                                 _mm256_add_epi8(promotions, promotions)));
+  total = _mm256_sad_epu8(bytes, _mm256_setzero_si256());
+
+  // Knights.
+  bytes = avx2ByteCounts(_mm256_and_si256(_mm256_and_si256(_mm256_slli_epi64(knights, 17), notA),
+                                          targets));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(_mm256_and_si256(
+    _mm256_and_si256(_mm256_slli_epi64(knights, 15), notH), targets)));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(_mm256_and_si256(
+    _mm256_and_si256(_mm256_slli_epi64(knights, 10), notAB), targets)));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(_mm256_and_si256(
+    _mm256_and_si256(_mm256_slli_epi64(knights, 6), notGH), targets)));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(_mm256_and_si256(
+    _mm256_and_si256(_mm256_srli_epi64(knights, 6), notAB), targets)));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(_mm256_and_si256(
+    _mm256_and_si256(_mm256_srli_epi64(knights, 10), notGH), targets)));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(_mm256_and_si256(
+    _mm256_and_si256(_mm256_srli_epi64(knights, 15), notA), targets)));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(_mm256_and_si256(
+    _mm256_and_si256(_mm256_srli_epi64(knights, 17), notH), targets)));
+
+  // Sliders.
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(_mm256_and_si256(
+    avx2FillUp(rookish, empty, 8, all), targets)));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(_mm256_and_si256(
+    avx2FillUp(rookish, empty, 1, notA), targets)));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(_mm256_and_si256(
+    avx2FillUp(bishopish, empty, 9, notA), targets)));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(_mm256_and_si256(
+    avx2FillUp(bishopish, empty, 7, notH), targets)));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(_mm256_and_si256(
+    avx2FillDown(rookish, empty, 8, all), targets)));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(_mm256_and_si256(
+    avx2FillDown(rookish, empty, 1, notH), targets)));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(_mm256_and_si256(
+    avx2FillDown(bishopish, empty, 9, notH), targets)));
+  bytes = _mm256_add_epi8(bytes, avx2ByteCounts(_mm256_and_si256(
+    avx2FillDown(bishopish, empty, 7, notA), targets)));
+
+  total = _mm256_add_epi64(total, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+
+  _mm256_storeu_si256((__m256i*)totals, total);
+  for(i = 0; i < BATCH_LANES; i++) {
+    counts[i] = (uint32_t)totals[i];
+  }
+}
+#endif
+
+// Count the moves of the pieces in each of the first count lanes, into counts.
+static void
+countLanes(BatchLanes *lanes, int count, uint32_t *counts)
+{
+  BitBoard empty, knights, targets;
+  int i;
+
+#if defined(HAVE_AVX2_BATCH)
+  if(useAvx2) {
+    // Clear unused lanes, which then have no moves.
+    for(i = count; i < BATCH_LANES; i++) {
+      lanes->Pawns[i] = EmptyBoard;
+      lanes->Knights[i] = EmptyBoard;
+      lanes->Rookish[i] = EmptyBoard;
+      lanes->Bishopish[i] = EmptyBoard;
+    }
+    avx2CountLanes(lanes, counts);
+
+    return;
+  }
+#endif
+
+  for(i = 0; i < count; i++) {
+    empty = lanes->Empty[i];
+    knights = lanes->Knights[i];
+    targets = lanes->Targets[i];
+
+    counts[i] = countPawns(lanes->Pawns[i], empty, lanes->Enemy[i], FullyOccupied) +
+      PopCount((knights << 17) & NotFileAMask & targets) +
+      PopCount((knights << 15) & NotFileHMask & targets) +
+      PopCount((knights << 10) & NOT_FILE_AB_MASK & targets) +
+      PopCount((knights << 6) & NOT_FILE_GH_MASK & targets) +
+      PopCount((knights >> 6) & NOT_FILE_AB_MASK & targets) +
+      PopCount((knights >> 10) & NOT_FILE_GH_MASK & targets) +
+      PopCount((knights >> 15) & NotFileAMask & targets) +
+      PopCount((knights >> 17) & NotFileHMask & targets) +
+      PopCount(FillAttacksUp(lanes->Rookish[i], empty, 8, FullyOccupied) & targets) +
+      PopCount(FillAttacksUp(lanes->Rookish[i], empty, 1, NotFileAMask) & targets) +
+      PopCount(FillAttacksUp(lanes->Bishopish[i], empty, 9, NotFileAMask) & targets) +
+      PopCount(FillAttacksUp(lanes->Bishopish[i], empty, 7, NotFileHMask) & targets) +
+      PopCount(FillAttacksDown(lanes->Rookish[i], empty, 8, FullyOccupied) & targets) +
+      PopCount(FillAttacksDown(lanes->Rookish[i], empty, 1, NotFileHMask) & targets) +
+      PopCount(FillAttacksDown(lanes->Bishopish[i], empty, 9, NotFileHMask) & targets) +
+      PopCount(FillAttacksDown(lanes->Bishopish[i], empty, 7, NotFileAMask) & targets);
+  }
+}
+
+// Count the moves of white pawns, with targets restricted to mask. Each of the 4 promotions
+// counts as a move.
+static uint32_t
+countPawns(BitBoard pawns, BitBoard empty, BitBoard enemy, BitBoard mask)
+{
+  BitBoard push = (pawns << 8) & empty;
+  BitBoard doublePush = ((push & Rank3Mask) << 8) & empty & mask;
+  BitBoard west = (pawns << 7) & NotFileHMask & enemy & mask;
+  BitBoard east = (pawns << 9) & NotFileAMask & enemy & mask;
+
+  push &= mask;
+
+  return PopCount(push) + PopCount(west) + PopCount(east) + PopCount(doublePush) +
+    3*(PopCount(push & Rank8Mask) + PopCount(west & Rank8Mask) + PopCount(east & Rank8Mask));
+}
+
+// Count the moves of our pinned pieces, which can only move along the line of the pin.
+static uint32_t
+countPinned(Game *game, BitBoard pinned)
+{
+  ChessSet *chessSet = &game->ChessSet;
+  Side side = game->WhosTurn;
+  BitBoard enemy = chessSet->Sets[OPPOSITE(side)].Occupancy;
+  BitBoard occupancy = chessSet->Occupancy;
+  BitBoard line, targets;
+  Position from, king = game->CheckStats.DefendedKing;
+  uint32_t ret = 0;
+
+  while(pinned) {
+    from = PopForward(&pinned);
+    line = lineThrough(king, from);
+    targets = line & ~chessSet->Sets[side].Occupancy;
+
+    switch(PieceAt(chessSet, from)) {
+    case Pawn:
+      ret += countPawns(flip(POSBOARD(from), side), flip(~occupancy, side), flip(enemy, side),
+                        flip(line, side));
+      break;
+    case Bishop:
+      ret += PopCount(BishopAttacksFrom(from, occupancy) & targets);
+      break;
+    case Rook:
+      ret += PopCount(RookAttacksFrom(from, occupancy) & targets);
+      break;
+    case Queen:
+      ret += PopCount((BishopAttacksFrom(from, occupancy) | RookAttacksFrom(from, occupancy)) &
+                      targets);
+      break;
+    default:
+      // A pinned knight can't move at all.
+      break;
+    }
+  }
+
+  return ret;
+}
+
+// Flip the board vertically for black, so it is as if white were to move.
+static FORCE_INLINE BitBoard
+flip(BitBoard bitBoard, Side side)
+{
+  return side == White ? bitBoard : __builtin_bswap64(bitBoard);
+}
+
+// The squares on the line through two aligned squares, excluding the first.
+static FORCE_INLINE BitBoard
+lineThrough(Position pos1, Position pos2)
+{
+  Piece piece = RANK(pos1) == RANK(pos2) || FILE(pos1) == FILE(pos2) ? Rook : Bishop;
+
+  // The other lines through each square only cross at squares not on both.
+  return (EmptyAttacks[piece][pos1] & EmptyAttacks[piece][pos2]) | POSBOARD(pos2);
+}
+
+// Set up the specified lane to count the position's piece moves, storing the moves counted
+// separately in count. Evasions and en passant are rare enough that we leave them to the move
+// generator, in which case count is the full count and we return false.
+static bool
+prepareLane(Game *game, BatchLanes *lanes, int lane, uint32_t *count)
+{
+  BitBoard own, pinned;
+  BitBoard *boards;
+  ChessSet *chessSet = &game->ChessSet;
+  Move buffer[INIT_MOVE_LEN];
+  Side side = game->WhosTurn;
+
+  if(game->CheckStats.CheckSources || game->EnPassantSquare != EmptyPosition) {
+    *count = AllMoves(buffer, game) - buffer;
+    return false;
+  }
+
+  boards = chessSet->Sets[side].Boards;
+  own = chessSet->Sets[side].Occupancy;
+  pinned = Pinned(game);
+
+  // Threats are calculated with our king removed, as for evasions.
+  *count = PopCount(KingAttacksFrom(game->CheckStats.DefendedKing) & ~own & ~Threats(game)) +
+    (CastleMoves(game, buffer) - buffer);
+  if(pinned) {
+    *count += countPinned(game, pinned);
+  }
+
+  lanes->Pawns[lane] = flip(boards[Pawn] & ~pinned, side);
+  lanes->Knights[lane] = flip(boards[Knight] & ~pinned, side);
+  lanes->Rookish[lane] = flip((boards[Rook] | boards[Queen]) & ~pinned, side);
+  lanes->Bishopish[lane] = flip((boards[Bishop] | boards[Queen]) & ~pinned, side);
+  lanes->Empty[lane] = flip(chessSet->EmptySquares, side);
+  lanes->Targets[lane] = flip(~own, side);
+  lanes->Enemy[lane] = flip(chessSet->Sets[OPPOSITE(side)].Occupancy, side);
+
+  return true;
+}
@@ -24,15 +24,86 @@
 
 #include "../weak.h"
 
-#define BENCH_COUNT 1
-// Minimum elapsed time to take a measurement from, in ms.
-#define MIN_ELAPSED 1000
+// Perft, then the micro-benchmarks.
+#define BENCH_COUNT (1 + MICRO_BENCH_COUNT)
+#define MICRO_BENCH_COUNT 14
+// Minimum elapsed time of a single timed run, in ms.
+#define MIN_ELAPSED 200
+// Runs discarded before measuring, to warm caches and branch predictors.
+#define BENCH_WARMUP_RUNS 1
+
+#if defined(QUICK_BENCH)
+#define BENCH_RUNS 5
+#else
+#define BENCH_RUNS 11
+#endif
+
+enum BenchCounter {
+  CounterCycles,
+  CounterInstructions,
+  CounterBranchMisses,
+  CounterL1dMisses,
+  CounterLlcMisses,
+  CounterDtlbMisses,
+  CounterCount
+};
+
+typedef enum BenchCounter BenchCounter;
+
+typedef struct BenchCounters BenchCounters;
+struct BenchCounters {
+  bool     Valid[CounterCount];
+  uint64_t Values[CounterCount];
+};
+
+typedef struct BenchStats BenchStats;
+struct BenchStats {
+  // Per-operation timings, in ms.
+  double Median, P10, P90, Mean, StdDev;
+  // Hardware counter totals over all timed runs, i.e. Runs*Iters operations.
+  BenchCounters Counters;
+  int64_t Nodes;
+  long Iters;
+  int Runs;
+};
+
+// counters.c
+char* CounterName(BenchCounter);
+bool  OpenCounters(void);
+void  StartCounters(void);
+void  StopCounters(BenchCounters*);
+
+// eval_bench.c
+void BenchEvaluate(void);
+
+// fen_bench.c
+void BenchFen(void);
+
+// micro_bench.c
+void InitMicroBenches(int);
 
 // perft_bench.c
+void BenchHashPerft(void);
 void BenchPerft(void);
+void BenchPerftThreads(void);
+
+// search_bench.c
+void BenchMoveOrdering(void);
+void BenchSearch(void);
+void BenchSeePruning(void);
+void BenchTimeControl(void);
+void BenchSearchThreads(void);
+
+// trans_bench.c
+void BenchTransLatency(void);
+void BenchTransProbes(void);
 
 // util.c
-void OutputBenchResults(char*, double, long, int64_t);
+void       OutputBenchResults(char*, double, long, int64_t);
+void       OutputBenchStats(char*, BenchStats*);
+BenchStats RunBench(int64_t (*)(void));
+BenchStats RunBenchSetup(void (*)(void), int64_t (*)(void));
+void       WriteBenchJson(char*);
 
 int64_t (*BenchFunctions[BENCH_COUNT])(void);
 char *BenchNames[BENCH_COUNT];
@@ -0,0 +1,182 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Optional hardware performance counters via perf_event_open(). Each event is opened on its own
+// so that whichever the processor, kernel or virtual machine supports can still be reported.
+
+static char *counterNames[CounterCount] = {
+  "cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses", "dTLB-misses"
+};
+
+static int counterFds[CounterCount] = { -1, -1, -1, -1, -1, -1 };
+static bool countersOpen;
+
+#if defined(__linux__)
+static int  openCounter(uint32_t, uint64_t);
+static bool readCounter(int, uint64_t*);
+#endif
+
+char*
+CounterName(BenchCounter counter)
+{
+  return counterNames[counter];
+}
+
+// Open whichever counters are available, reporting any that aren't. Returns false if none are.
+bool
+OpenCounters()
+{
+#if defined(__linux__)
+  BenchCounter counter;
+  int count = 0;
+
+#define CACHE_READ_MISS(cache) \
+  ((cache)|(PERF_COUNT_HW_CACHE_OP_READ<<8)|(PERF_COUNT_HW_CACHE_RESULT_MISS<<16))
+
+  counterFds[CounterCycles] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  counterFds[CounterInstructions] = openCounter(PERF_TYPE_HARDWARE,
+                                                PERF_COUNT_HW_INSTRUCTIONS);
+  counterFds[CounterBranchMisses] = openCounter(PERF_TYPE_HARDWARE,
+                                                PERF_COUNT_HW_BRANCH_MISSES);
+  counterFds[CounterL1dMisses] = openCounter(PERF_TYPE_HW_CACHE,
+                                             CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D));
+  counterFds[CounterLlcMisses] = openCounter(PERF_TYPE_HW_CACHE,
+                                             CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL));
+  counterFds[CounterDtlbMisses] = openCounter(PERF_TYPE_HW_CACHE,
+                                              CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB));
+
+#undef CACHE_READ_MISS
+
+  for(counter = 0; counter < CounterCount; counter++) {
+    if(counterFds[counter] >= 0) {
+      count++;
+    } else {
+      fprintf(stderr, "Counter %s unavailable.\n", counterNames[counter]);
+    }
+  }
+
+  countersOpen = count > 0;
+#else
+  fprintf(stderr, "Hardware counters are only supported on Linux.\n");
+#endif
+
+  return countersOpen;
+}
+
+// Reset and enable all open counters.
+void
+StartCounters()
+{
+#if defined(__linux__)
+  BenchCounter counter;
+
+  if(!countersOpen) {
+    return;
+  }
+
+  for(counter = 0; counter < CounterCount; counter++) {
+    if(counterFds[counter] >= 0) {
+      ioctl(counterFds[counter], PERF_EVENT_IOC_RESET, 0);
+      ioctl(counterFds[counter], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#endif
+}
+
+// Disable all open counters and read them into counters. Counters which aren't available are
+// marked invalid.
+void
+StopCounters(BenchCounters *counters)
+{
+  BenchCounter counter;
+
+  for(counter = 0; counter < CounterCount; counter++) {
+    counters->Valid[counter] = false;
+    counters->Values[counter] = 0;
+  }
+
+#if defined(__linux__)
+  if(!countersOpen) {
+    return;
+  }
+
+  for(counter = 0; counter < CounterCount; counter++) {
+    if(counterFds[counter] >= 0) {
+      ioctl(counterFds[counter], PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+  for(counter = 0; counter < CounterCount; counter++) {
+    if(counterFds[counter] >= 0) {
+      counters->Valid[counter] = readCounter(counterFds[counter], &counters->Values[counter]);
+    }
+  }
+#endif
+}
+
+#if defined(__linux__)
+static int
+openCounter(uint32_t type, uint64_t config)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  // Count threads spawned by the benchmark too, e.g. parallel search.
+  attr.inherit = 1;
+  // If there are more events than hardware counters the kernel multiplexes them, so we need
+  // these to scale up the result.
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  // This process on any CPU.
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static bool
+readCounter(int fd, uint64_t *ret)
+{
+  // Value, time enabled, time running.
+  uint64_t values[3];
+
+  if(read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) {
+    return false;
+  }
+
+  *ret = values[2] < values[1] ? (uint64_t)((double)values[0]*values[1]/values[2]) : values[0];
+
+  return true;
+}
+#endif
@@ -0,0 +1,134 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "../weak.h"
+#include "bench.h"
+
+#if defined(QUICK_BENCH)
+#define EVAL_DEPTH 4
+#else
+#define EVAL_DEPTH 5
+#endif
+
+#define EVAL_FEN_COUNT 3
+
+enum EvalMode {
+  NoEval,
+  IncrementalEval,
+  FullEval,
+  EvalModeCount
+};
+
+static char *evalFens[EVAL_FEN_COUNT] = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -",
+  "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1"
+};
+
+static char *evalModeNames[EvalModeCount] = { "No Eval", "Incremental Eval", "Full Eval" };
+
+// Positions and mode RunBench walks operate on, and the sum of their evaluations.
+static Game          evalGames[EVAL_FEN_COUNT];
+static enum EvalMode evalMode;
+static int64_t       evalSum;
+
+static int64_t  runWalk(void);
+static uint64_t walk(Game*, int, enum EvalMode, int64_t*);
+
+// Measure the cost of evaluating every node of a tree walk, comparing the incrementally maintained
+// score with calculating it from scratch. The walk without evaluation is the baseline subtracted
+// from each.
+void
+BenchEvaluate()
+{
+  BenchStats stats;
+  char tmp[200];
+  double elapsed[EvalModeCount];
+  enum EvalMode mode;
+  int i;
+
+  for(i = 0; i < EVAL_FEN_COUNT; i++) {
+    evalGames[i] = ParseFen(evalFens[i]);
+  }
+
+  for(mode = NoEval; mode < EvalModeCount; mode++) {
+    evalMode = mode;
+    evalSum = 0;
+    stats = RunBench(runWalk);
+    elapsed[mode] = stats.Median;
+
+    sprintf(tmp, "Eval Walk Depth %d %s", EVAL_DEPTH, evalModeNames[mode]);
+    OutputBenchStats(tmp, &stats);
+
+    if(mode != NoEval) {
+      printf("%s Cost:\t%.2f\tns/node\t(checksum %ld)\n", evalModeNames[mode],
+             1E6*(elapsed[mode] - elapsed[NoEval])/stats.Nodes, evalSum);
+    }
+  }
+
+  for(i = 0; i < EVAL_FEN_COUNT; i++) {
+    ReleaseGame(&evalGames[i]);
+  }
+}
+
+// Walk every position, returning the number of nodes visited.
+static int64_t
+runWalk()
+{
+  int i;
+  uint64_t ret = 0;
+
+  for(i = 0; i < EVAL_FEN_COUNT; i++) {
+    ret += walk(&evalGames[i], EVAL_DEPTH, evalMode, &evalSum);
+  }
+
+  return (int64_t)ret;
+}
+
+// Visit every node to the specified depth, evaluating each according to mode and summing the
+// results so the evaluation can't be optimised away.
+static uint64_t
+walk(Game *game, int depth, enum EvalMode mode, int64_t *sum)
+{
+  Move *curr, *end;
+  Move buffer[INIT_MOVE_LEN];
+  uint64_t ret = 1;
+
+  if(mode == IncrementalEval) {
+    *sum += Evaluate(game);
+  } else if(mode == FullEval) {
+    *sum += game->WhosTurn == White ? ScoreGame(game) : -ScoreGame(game);
+  }
+
+  if(depth == 0) {
+    return ret;
+  }
+
+  end = AllMoves(buffer, game);
+  for(curr = buffer; curr < end; curr++) {
+    DoMove(game, *curr);
+    ret += walk(game, depth - 1, mode, sum);
+    Unmove(game);
+  }
+
+  return ret;
+}
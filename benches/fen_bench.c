@@ -0,0 +1,146 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "../weak.h"
+#include "bench.h"
+
+#if defined(QUICK_BENCH)
+#define FEN_PASSES 5
+#else
+#define FEN_PASSES 50
+#endif
+
+// Positions are collected from every node of a walk to FEN_DEPTH from each starting position.
+#define FEN_DEPTH        3
+#define FEN_CORPUS_COUNT 2
+#define MAX_CORPUS_SIZE  50000
+
+static char *corpusFens[FEN_CORPUS_COUNT] = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1"
+};
+
+static void collect(Game*, int, char (*)[MAX_FEN_LEN], int*);
+static void outputThroughput(char*, double, int);
+
+// Measure FEN parsing and writing throughput in positions per second over a corpus of positions
+// reached from the perft positions, so it includes en passant squares, castling rights and
+// clocks.
+void
+BenchFen()
+{
+  char (*fens)[MAX_FEN_LEN] = allocate(MAX_FEN_LEN, MAX_CORPUS_SIZE);
+  char buffer[MAX_FEN_LEN];
+  double elapsed;
+  Game game, parsed;
+  int count = 0, i, pass;
+  size_t *lens = allocate(sizeof(size_t), MAX_CORPUS_SIZE);
+  struct timespec end, start;
+  uint64_t sum = 0;
+
+  for(i = 0; i < FEN_CORPUS_COUNT; i++) {
+    game = ParseFen(corpusFens[i]);
+    collect(&game, FEN_DEPTH, fens, &count);
+    ReleaseGame(&game);
+  }
+  for(i = 0; i < count; i++) {
+    lens[i] = strlen(fens[i]);
+  }
+
+  game = NewEmptyGame(false, White);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(pass = 0; pass < FEN_PASSES; pass++) {
+    for(i = 0; i < count; i++) {
+      if(ParseFenInto(&game, fens[i], lens[i]) != FenOk) {
+        panic("Couldn't parse FEN '%s'.", fens[i]);
+      }
+      sum += game.Hash;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  // In ms.
+  elapsed = 1E3*(end.tv_sec - start.tv_sec) + 1E-6*(end.tv_nsec - start.tv_nsec);
+  outputThroughput("ParseFenInto", elapsed, FEN_PASSES*count);
+
+  // ParseFen() allocates a new game each time.
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(pass = 0; pass < FEN_PASSES; pass++) {
+    for(i = 0; i < count; i++) {
+      parsed = ParseFen(fens[i]);
+      sum += parsed.Hash;
+      ReleaseGame(&parsed);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  elapsed = 1E3*(end.tv_sec - start.tv_sec) + 1E-6*(end.tv_nsec - start.tv_nsec);
+  outputThroughput("ParseFen", elapsed, FEN_PASSES*count);
+
+  ParseFenInto(&game, fens[count/2], lens[count/2]);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(i = 0; i < FEN_PASSES*count; i++) {
+    sum += WriteFen(&game, buffer);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  elapsed = 1E3*(end.tv_sec - start.tv_sec) + 1E-6*(end.tv_nsec - start.tv_nsec);
+  outputThroughput("WriteFen", elapsed, FEN_PASSES*count);
+
+  printf("FEN corpus of %d positions (checksum %lu)\n", count, sum);
+
+  ReleaseGame(&game);
+  release(fens);
+  release(lens);
+}
+
+// Write the FEN of every position within depth plies to fens.
+static void
+collect(Game *game, int depth, char (*fens)[MAX_FEN_LEN], int *count)
+{
+  Move *curr, *end;
+  Move buffer[INIT_MOVE_LEN];
+
+  if(*count == MAX_CORPUS_SIZE) {
+    return;
+  }
+
+  WriteFen(game, fens[(*count)++]);
+
+  if(depth == 0) {
+    return;
+  }
+
+  end = AllMoves(buffer, game);
+  for(curr = buffer; curr < end; curr++) {
+    DoMove(game, *curr);
+    collect(game, depth - 1, fens, count);
+    Unmove(game);
+  }
+}
+
+static void
+outputThroughput(char *name, double elapsed, int positions)
+{
+  printf("FEN %s:\t%.3f\tms\t%.0f\tpositions/s\n", name, elapsed, 1E3*positions/elapsed);
+}
@@ -21,7 +21,6 @@
 
 #include <stdio.h>
 #include <string.h>
-#include <time.h>
 #include "bench.h"
 
 static void
@@ -30,43 +29,71 @@ init()
   // Perft benchmark handled specially.
   BenchFunctions[0] = NULL;
   BenchNames[0] = strdup("Perft Benchmark");
+
+  InitMicroBenches(1);
 }
 
 int
-main()
+main(int argc, char **argv)
 {
-  clock_t ticks;
-  double elapsed;
+  BenchStats stats;
+  bool counters = false, threadsOnly = false;
+  char *jsonPath = NULL;
   int i;
-  int64_t nodes;
-  long iters, j;
 
-  init();
+  for(i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      jsonPath = argv[++i];
+    } else if(strcmp(argv[i], "--counters") == 0) {
+      counters = true;
+    } else if(strcmp(argv[i], "--threads") == 0) {
+      threadsOnly = true;
+    } else {
+      fprintf(stderr, "usage: %s [--counters] [--threads] [--json path]\n", argv[0]);
+      return 1;
+    }
+  }
+
   InitEngine();
+  init();
+
+  if(counters && !OpenCounters()) {
+    fprintf(stderr, "No hardware counters available, reporting timings only.\n");
+  }
 
   // Want results to appear as soon as they are ready.
   SetUnbufferedOutput();
 
-  // Handle perft benchmark specially.
+  // Only measure thread scaling, see make benchthreads.
+  if(threadsOnly) {
+    BenchPerftThreads();
+    if(jsonPath != NULL) {
+      WriteBenchJson(jsonPath);
+    }
+
+    return 0;
+  }
+
+  // Handle perft benchmarks specially.
   BenchPerft();
+  BenchHashPerft();
+  BenchTransLatency();
+  BenchTransProbes();
+  BenchSearch();
+  BenchSearchThreads();
+  BenchSeePruning();
+  BenchMoveOrdering();
+  BenchTimeControl();
+  BenchEvaluate();
+  BenchFen();
 
   for(i = 1; i < BENCH_COUNT; i++) {
-    elapsed = 0;
-    iters = 1;
-    while(elapsed < MIN_ELAPSED) {
-      ticks = clock();
-      for(j = 0; j < iters; j++) {
-        nodes = BenchFunctions[i]();
-      }
-      ticks = clock() - ticks;
-      // In ms.
-      elapsed = 1000*((double)ticks)/CLOCKS_PER_SEC;
-      iters *= 2;
-    }
-    // Remove final *2.
-    iters /= 2;
+    stats = RunBench(BenchFunctions[i]);
+    OutputBenchStats(BenchNames[i], &stats);
+  }
 
-    OutputBenchResults(BenchNames[i], elapsed, iters, nodes);
+  if(jsonPath != NULL) {
+    WriteBenchJson(jsonPath);
   }
 
   return 0;
@@ -0,0 +1,404 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "../weak.h"
+#include "../magic.h"
+#include "bench.h"
+
+// Micro-benchmarks of individual hot functions over a fixed corpus, the positions below and
+// every position one ply from them. Each returns the number of calls it made, so the reported
+// Mn/s is millions of calls per second.
+
+#define MICRO_FEN_COUNT   8
+#define MICRO_CORPUS_MAX  512
+#define MICRO_KEYS_MAX    (MICRO_CORPUS_MAX*64)
+// Small enough to mostly stay in cache, so we time the table logic rather than DRAM.
+#define MICRO_TRANS_SIZE_MB 16
+
+static char *microFens[MICRO_FEN_COUNT] = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+  "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+  "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+  "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+  "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+  "r1bq1rk1/pp2ppbp/2np1np1/8/3NP3/2N1BP2/PPPQ2PP/R3KB1R w KQ - 3 9",
+  "6k1/5pp1/7p/8/8/1r5P/5PP1/R5K1 w - - 0 30"
+};
+
+static Game corpus[MICRO_CORPUS_MAX];
+static Game *corpusGames[MICRO_CORPUS_MAX];
+static char corpusFens[MICRO_CORPUS_MAX][MAX_FEN_LEN];
+static Move corpusMoves[MICRO_CORPUS_MAX][INIT_MOVE_LEN];
+static int corpusCount, moveCounts[MICRO_CORPUS_MAX];
+// Hashes of the corpus and its children, for transposition table probes.
+static uint64_t keys[MICRO_KEYS_MAX];
+static int keyCount;
+static uint64_t transEntries;
+
+// Whether SlidingAttacks() and CountMovesBatch() use their AVX2 kernels outside of the scalar
+// benchmarks.
+static bool vectorisedBatch, vectorisedFill;
+
+// Results are folded in here so the compiler can't discard the work.
+static volatile uint64_t sink;
+
+static void    addCorpus(Game*);
+static int64_t benchAllAttacks(void);
+static int64_t benchAllAttacksScalar(void);
+static int64_t benchAllMoves(void);
+static int64_t benchBishopAttacks(void);
+static int64_t benchCheckStats(void);
+static int64_t benchCountMovesBatch(void);
+static int64_t benchCountMovesBatchScalar(void);
+static int64_t benchDoUnmove(void);
+static int64_t benchHashGame(void);
+static int64_t benchLookupPosition(void);
+static int64_t benchParseFen(void);
+static int64_t benchPinnedPieces(void);
+static int64_t benchRookAttacks(void);
+static int64_t benchSavePosition(void);
+static void    ensureTrans(void);
+
+// Build the corpus and register the micro-benchmarks in BenchFunctions, from index first on.
+void
+InitMicroBenches(int first)
+{
+  Game game;
+  int i, j;
+  Move *curr, *end;
+  Move buffer[INIT_MOVE_LEN];
+
+  for(i = 0; i < MICRO_FEN_COUNT; i++) {
+    game = ParseFen(microFens[i]);
+    addCorpus(&game);
+
+    end = AllMoves(buffer, &game);
+    for(curr = buffer; curr < end; curr++) {
+      DoMove(&game, *curr);
+      addCorpus(&game);
+      Unmove(&game);
+    }
+
+    ReleaseGame(&game);
+  }
+
+  for(i = 0; i < corpusCount; i++) {
+    corpusGames[i] = &corpus[i];
+    moveCounts[i] = AllMoves(corpusMoves[i], &corpus[i]) - corpusMoves[i];
+
+    keys[keyCount++] = corpus[i].Hash;
+    for(j = 0; j < moveCounts[i] && keyCount < MICRO_KEYS_MAX; j++) {
+      DoMove(&corpus[i], corpusMoves[i][j]);
+      keys[keyCount++] = corpus[i].Hash;
+      Unmove(&corpus[i]);
+    }
+  }
+
+  vectorisedBatch = InitCountMovesBatch(true);
+  vectorisedFill = InitSlidingAttacks(true);
+
+  BenchFunctions[first] = benchAllMoves;
+  BenchNames[first++] = "AllMoves";
+  BenchFunctions[first] = benchCountMovesBatch;
+  BenchNames[first++] = "CountMovesBatch";
+  BenchFunctions[first] = benchCountMovesBatchScalar;
+  BenchNames[first++] = "CountMovesBatch (scalar)";
+  BenchFunctions[first] = benchDoUnmove;
+  BenchNames[first++] = "DoMove+Unmove";
+  BenchFunctions[first] = benchCheckStats;
+  BenchNames[first++] = "CalculateCheckStats";
+  BenchFunctions[first] = benchPinnedPieces;
+  BenchNames[first++] = "PinnedPieces";
+  BenchFunctions[first] = benchRookAttacks;
+  BenchNames[first++] = "RookAttacksFrom";
+  BenchFunctions[first] = benchBishopAttacks;
+  BenchNames[first++] = "BishopAttacksFrom";
+  BenchFunctions[first] = benchAllAttacks;
+  BenchNames[first++] = "AllAttacksFrom";
+  BenchFunctions[first] = benchAllAttacksScalar;
+  BenchNames[first++] = "AllAttacksFrom (scalar fill)";
+  BenchFunctions[first] = benchHashGame;
+  BenchNames[first++] = "HashGame";
+  BenchFunctions[first] = benchSavePosition;
+  BenchNames[first++] = "SavePosition";
+  BenchFunctions[first] = benchLookupPosition;
+  BenchNames[first++] = "LookupPosition";
+  BenchFunctions[first] = benchParseFen;
+  BenchNames[first] = "ParseFen";
+
+  printf("Micro-benchmark corpus of %d positions, %d keys\n", corpusCount, keyCount);
+}
+
+static void
+addCorpus(Game *game)
+{
+  if(corpusCount == MICRO_CORPUS_MAX) {
+    panic("Micro-benchmark corpus exceeds %d positions.", MICRO_CORPUS_MAX);
+  }
+
+  WriteFen(game, corpusFens[corpusCount]);
+  corpus[corpusCount] = ParseFen(corpusFens[corpusCount]);
+  corpusCount++;
+}
+
+static int64_t
+benchAllMoves()
+{
+  int i;
+  Move buffer[INIT_MOVE_LEN];
+  uint64_t count = 0;
+
+  for(i = 0; i < corpusCount; i++) {
+    // As if we had just moved here, so any CheckStats fields needed are calculated afresh.
+    corpus[i].CheckStats.Stale = ALL_STALE_FIELDS;
+    count += AllMoves(buffer, &corpus[i]) - buffer;
+  }
+  sink += count;
+
+  return corpusCount;
+}
+
+// Attack maps for both sides, with the fill SlidingAttacks() picked at startup.
+static int64_t
+benchAllAttacks()
+{
+  BitBoard ret = EmptyBoard;
+  ChessSet *chessSet;
+  int i;
+
+  for(i = 0; i < corpusCount; i++) {
+    chessSet = &corpus[i].ChessSet;
+    ret ^= AllAttacksFrom(chessSet, White, chessSet->Occupancy);
+    ret ^= AllAttacksFrom(chessSet, Black, chessSet->Occupancy);
+  }
+  sink += ret;
+
+  return 2*corpusCount;
+}
+
+// As benchAllAttacks(), forcing the scalar fill.
+static int64_t
+benchAllAttacksScalar()
+{
+  int64_t ret;
+
+  InitSlidingAttacks(false);
+  ret = benchAllAttacks();
+  InitSlidingAttacks(vectorisedFill);
+
+  return ret;
+}
+
+static int64_t
+benchBishopAttacks()
+{
+  BitBoard ret = EmptyBoard;
+  int i;
+  Position pos;
+
+  for(i = 0; i < corpusCount; i++) {
+    for(pos = A1; pos <= H8; pos++) {
+      ret ^= BishopAttacksFrom(pos, corpus[i].ChessSet.Occupancy);
+    }
+  }
+  sink += ret;
+
+  return 64*corpusCount;
+}
+
+static int64_t
+benchCheckStats()
+{
+  CheckStats stats;
+  int i;
+  uint64_t ret = 0;
+
+  for(i = 0; i < corpusCount; i++) {
+    stats = CalculateCheckStats(&corpus[i]);
+    ret ^= stats.Pinned ^ stats.Discovered ^ stats.CheckSquares[Knight];
+  }
+  sink += ret;
+
+  return corpusCount;
+}
+
+// Positions per second counted by CountMovesBatch(), comparable with benchAllMoves().
+static int64_t
+benchCountMovesBatch()
+{
+  int i;
+  uint32_t counts[MICRO_CORPUS_MAX];
+
+  for(i = 0; i < corpusCount; i++) {
+    corpus[i].CheckStats.Stale = ALL_STALE_FIELDS;
+  }
+  CountMovesBatch(corpusGames, corpusCount, counts);
+
+  for(i = 0; i < corpusCount; i++) {
+    sink += counts[i];
+  }
+
+  return corpusCount;
+}
+
+// As benchCountMovesBatch(), forcing the scalar kernel.
+static int64_t
+benchCountMovesBatchScalar()
+{
+  int64_t ret;
+
+  InitCountMovesBatch(false);
+  ret = benchCountMovesBatch();
+  InitCountMovesBatch(vectorisedBatch);
+
+  return ret;
+}
+
+static int64_t
+benchDoUnmove()
+{
+  int i, j;
+  int64_t ret = 0;
+  uint64_t hashes = 0;
+
+  for(i = 0; i < corpusCount; i++) {
+    for(j = 0; j < moveCounts[i]; j++) {
+      DoMove(&corpus[i], corpusMoves[i][j]);
+      hashes ^= corpus[i].Hash;
+      Unmove(&corpus[i]);
+    }
+    ret += moveCounts[i];
+  }
+  sink += hashes;
+
+  return ret;
+}
+
+static int64_t
+benchHashGame()
+{
+  int i;
+  uint64_t ret = 0;
+
+  for(i = 0; i < corpusCount; i++) {
+    ret ^= HashGame(&corpus[i]);
+  }
+  sink += ret;
+
+  return corpusCount;
+}
+
+static int64_t
+benchLookupPosition()
+{
+  int i;
+  TransEntry entry;
+  uint64_t found = 0;
+
+  ensureTrans();
+
+  for(i = 0; i < keyCount; i++) {
+    found += LookupPosition(keys[i], &entry);
+  }
+  sink += found;
+
+  return keyCount;
+}
+
+static int64_t
+benchParseFen()
+{
+  Game game;
+  int i;
+  uint64_t ret = 0;
+
+  for(i = 0; i < corpusCount; i++) {
+    game = ParseFen(corpusFens[i]);
+    ret ^= game.Hash;
+    ReleaseGame(&game);
+  }
+  sink += ret;
+
+  return corpusCount;
+}
+
+static int64_t
+benchPinnedPieces()
+{
+  BitBoard ret = EmptyBoard;
+  ChessSet *chessSet;
+  int i;
+  Side side;
+
+  for(i = 0; i < corpusCount; i++) {
+    chessSet = &corpus[i].ChessSet;
+    side = corpus[i].WhosTurn;
+    ret ^= PinnedPieces(chessSet, side, corpus[i].CheckStats.DefendedKing, true);
+  }
+  sink += ret;
+
+  return corpusCount;
+}
+
+static int64_t
+benchRookAttacks()
+{
+  BitBoard ret = EmptyBoard;
+  int i;
+  Position pos;
+
+  for(i = 0; i < corpusCount; i++) {
+    for(pos = A1; pos <= H8; pos++) {
+      ret ^= RookAttacksFrom(pos, corpus[i].ChessSet.Occupancy);
+    }
+  }
+  sink += ret;
+
+  return 64*corpusCount;
+}
+
+static int64_t
+benchSavePosition()
+{
+  int i;
+
+  ensureTrans();
+
+  for(i = 0; i < keyCount; i++) {
+    SavePosition(keys[i], i, 0, i&15, LowerBound);
+  }
+
+  return keyCount;
+}
+
+// Other benchmarks resize the transposition table, so check it's ours before probing it.
+static void
+ensureTrans()
+{
+  if(TransEntries() != transEntries) {
+    ResizeTrans(MICRO_TRANS_SIZE_MB);
+    ClearTrans();
+    transEntries = TransEntries();
+  }
+}
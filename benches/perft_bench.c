@@ -20,16 +20,26 @@
 */
 
 #include <stdio.h>
-#include <time.h>
 #include "../weak.h"
 #include "bench.h"
 
 #if defined(QUICK_BENCH)
 #define MAX_DEPTH 6
+#define MAX_HASH_DEPTH 5
+#define MAX_THREADS_DEPTH 5
 #else
 #define MAX_DEPTH 7
+#define MAX_HASH_DEPTH 6
+#define MAX_THREADS_DEPTH 6
 #endif
 
+#define MAX_BENCH_THREADS 64
+// Shared by all threads, so made large enough not to saturate at the deepest bench.
+#define THREADS_HASH_SIZE_MB 256
+
+// Large enough that cluster lookups routinely miss cache.
+#define HASH_BENCH_SIZE_MB 1024
+
 // Perft positions, see http://chessprogramming.wikispaces.com/Perft+Results.
 
 #define PERFT_COUNT 5
@@ -44,15 +54,23 @@ static char *fens[PERFT_COUNT] = { FEN1, FEN2, FEN3, FEN4, FEN4_REVERSED };
 static Game games[PERFT_COUNT];
 static int depthCounts[PERFT_COUNT] = { 6, 5, 7, 6, 6 };
 
+// Position and depth RunBench perft calls operate on, and whether hashed perft prefetches.
+static Game *perftGame;
+static int perftDepth;
+static bool perftPrefetch;
+
+static int64_t runHashPerft(void);
+static int64_t runPerft(void);
+static int     threadCounts(int*);
+
 void
 BenchPerft()
 {
+  BenchStats stats;
   char tmp[200];
-  clock_t ticks;
-  double elapsed, totalElapsed = 0;
+  double totalElapsed = 0;
   int i, j;
-  int64_t nodes, totalNodes = 0;
-  long iters, k;
+  int64_t totalNodes = 0;
 
   // Initialise games.
   for(i = 0; i < PERFT_COUNT; i++) {
@@ -62,29 +80,151 @@ BenchPerft()
   for(i = 0; i < PERFT_COUNT; i++) {
     // Depth 1-3 tests are too short to be meaningful. Ignore.
     for(j = 4; j <= depthCounts[i] && j <= MAX_DEPTH; j++) {
-      elapsed = 0;
-      iters = 1;
+      perftGame = &games[i];
+      perftDepth = j;
+      stats = RunBench(runPerft);
 
-      while(elapsed < MIN_ELAPSED) {
-        ticks = clock();
-        for(k = 0; k < iters; k++) {
-          nodes = (int64_t)QuickPerft(&games[i], j);
-        }
-        ticks = clock() - ticks;
+      totalNodes += stats.Nodes;
+      totalElapsed += stats.Median;
+
+      sprintf(tmp, "Perft Position %d Depth %d", i+1, j);
+      OutputBenchStats(tmp, &stats);
+    }
+  }
+
+  printf("Median Perft Performance: %f Mn/s\n", 1E-3*totalNodes/totalElapsed);
+}
+
+// Measure how parallel perft scales with thread count, with and without a shared transposition
+// table. Speedup and efficiency are relative to a single thread, and imbalance is the busiest
+// thread's node count relative to the mean, 1.0 being perfectly even.
+void
+BenchPerftThreads()
+{
+  char tmp[200];
+  double baseline, elapsed, imbalance, speedup, totalElapsed[MAX_BENCH_THREADS];
+  Game game;
+  int counts[MAX_BENCH_THREADS], depth, hash, i, j, k, n;
+  uint64_t busiest, start, threadNodes[MAX_BENCH_THREADS];
+  int64_t nodes, totalNodes;
+
+  ResizeTrans(THREADS_HASH_SIZE_MB);
+
+  n = threadCounts(counts);
+
+  for(hash = 0; hash <= 1; hash++) {
+    totalNodes = 0;
+    for(j = 0; j < n; j++) {
+      totalElapsed[j] = 0;
+    }
+
+    for(i = 0; i < PERFT_COUNT; i++) {
+      game = ParseFen(fens[i]);
+      depth = depthCounts[i] < MAX_THREADS_DEPTH ? depthCounts[i] : MAX_THREADS_DEPTH;
+
+      for(j = 0; j < n; j++) {
+        ClearTrans();
+
+        start = NanoTime();
+        nodes = (int64_t)ParallelPerft(&game, depth, counts[j], hash, threadNodes);
         // In ms.
-        elapsed = 1000*((double)ticks)/CLOCKS_PER_SEC;
-        iters *= 2;
+        elapsed = 1E-6*(NanoTime() - start);
+
+        busiest = 0;
+        for(k = 0; k < counts[j]; k++) {
+          busiest = threadNodes[k] > busiest ? threadNodes[k] : busiest;
+        }
+        imbalance = nodes > 0 ? (double)busiest*counts[j]/nodes : 1;
+
+        totalElapsed[j] += elapsed;
+        if(j == 0) {
+          totalNodes += nodes;
+        }
+
+        sprintf(tmp, "%sPerft Position %d Depth %d Threads %d", hash ? "Hash " : "", i+1, depth,
+                counts[j]);
+        OutputBenchResults(tmp, elapsed, 1, nodes);
+        printf("  Imbalance %.3f\n", imbalance);
       }
-      // Remove final *2.
-      iters /= 2;
 
-      totalNodes += nodes;
-      totalElapsed += elapsed/iters;
+      ReleaseGame(&game);
+    }
 
-      sprintf(tmp, "Perft Position %d Depth %d", i+1, j);
-      OutputBenchResults(tmp, elapsed, iters, nodes);
+    baseline = totalElapsed[0];
+    printf("%sPerft scaling:-\n", hash ? "Hash " : "");
+    for(j = 0; j < n; j++) {
+      speedup = baseline/totalElapsed[j];
+      printf("%2d threads:\t%.3f\tMn/s\tspeedup %.2fx\tefficiency %.1f%%\n", counts[j],
+             1E-3*totalNodes/totalElapsed[j], speedup, 100*speedup/counts[j]);
     }
   }
+}
 
-  printf("Median Perft Performance: %f Mn/s\n", 1E-3*totalNodes/totalElapsed);
+// Compare hashed perft with and without prefetching transposition table clusters.
+void
+BenchHashPerft()
+{
+  BenchStats stats;
+  char tmp[200];
+  double totalElapsed[2] = { 0, 0 };
+  Game game;
+  int i, prefetch;
+
+  ResizeTrans(HASH_BENCH_SIZE_MB);
+
+  for(i = 0; i < PERFT_COUNT; i++) {
+    game = ParseFen(fens[i]);
+    perftGame = &game;
+    perftDepth = depthCounts[i] < MAX_HASH_DEPTH ? depthCounts[i] : MAX_HASH_DEPTH;
+
+    for(prefetch = 0; prefetch <= 1; prefetch++) {
+      perftPrefetch = prefetch;
+      // Each run has to start from an empty table, otherwise it's just measuring lookups.
+      stats = RunBenchSetup(ClearTrans, runHashPerft);
+
+      totalElapsed[prefetch] += stats.Median;
+
+      sprintf(tmp, "Hash Perft Position %d Depth %d%s", i+1, perftDepth,
+              prefetch ? " Prefetch" : "");
+      OutputBenchStats(tmp, &stats);
+    }
+
+    ReleaseGame(&game);
+  }
+
+  printf("Prefetch Speedup (%d MB table): %.3fx\n", HASH_BENCH_SIZE_MB,
+         totalElapsed[0]/totalElapsed[1]);
+}
+
+static int64_t
+runHashPerft()
+{
+  return (int64_t)HashPerft(perftGame, perftDepth, perftPrefetch);
+}
+
+static int64_t
+runPerft()
+{
+  return (int64_t)QuickPerft(perftGame, perftDepth);
+}
+
+// Thread counts to measure scaling at, 1, 2, 4, ... up to the processor count, always including
+// the processor count itself, and at least 2 so the parallel path is measured.
+static int
+threadCounts(int *counts)
+{
+  int cpus = CpuCount(), n = 0, threads;
+
+  if(cpus < 2) {
+    cpus = 2;
+  } else if(cpus > MAX_BENCH_THREADS) {
+    cpus = MAX_BENCH_THREADS;
+  }
+
+  for(threads = 1; threads < cpus; threads *= 2) {
+    counts[n++] = threads;
+  }
+  counts[n++] = cpus;
+
+  return n;
 }
@@ -0,0 +1,364 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "../weak.h"
+#include "bench.h"
+
+#define SEARCH_BENCH_SIZE_MB 16
+
+#if defined(QUICK_BENCH)
+#define THREADS_DEPTH 6
+#else
+#define THREADS_DEPTH 7
+#endif
+
+#if defined(QUICK_BENCH)
+#define TACTICAL_DEPTH 6
+#else
+#define TACTICAL_DEPTH 7
+#endif
+
+// Move ordering is compared at each depth from ORDERING_MIN_DEPTH to ORDERING_MAX_DEPTH.
+#define ORDERING_MIN_DEPTH 4
+#if defined(QUICK_BENCH)
+#define ORDERING_MAX_DEPTH 6
+#else
+#define ORDERING_MAX_DEPTH 7
+#endif
+
+#if defined(QUICK_BENCH)
+#define OVERHEAD_DEPTH 6
+#else
+#define OVERHEAD_DEPTH 7
+#endif
+
+#define TIME_LIMITS       3
+#define NODE_LIMITS       3
+
+static uint64_t timeLimits[TIME_LIMITS] = { 10, 100, 500 };
+static uint64_t nodeLimits[NODE_LIMITS] = { 10000, 100000, 1000000 };
+
+#define THREAD_COUNTS     5
+#define THREADS_FEN_COUNT 3
+
+// Positions from the 'Win at Chess' test suite.
+
+#define TACTICAL_COUNT 5
+
+static char *tacticalFens[TACTICAL_COUNT] = {
+  "2rr3k/pp3pp1/1nnqbN1p/3pN3/2pP4/2P3Q1/PPB4P/R4RK1 w - -",
+  "8/7p/5k2/5p2/p1p2P2/Pr1pPK2/1P1R3P/8 b - -",
+  "5rk1/1ppb3p/p1pb4/6q1/3P1p1r/2P1R2P/PP1BQ1P1/5RKN w - -",
+  "r1bq2rk/pp3pbp/2p1p1pQ/7P/3P4/2PB1N2/PP3PPR/2KR4 w - -",
+  "5k2/6pp/p1qN4/1p1p4/3P4/2PKP2Q/PP3r2/3R4 b - -"
+};
+
+static int threadCounts[THREAD_COUNTS] = { 1, 2, 4, 8, 16 };
+
+static char *threadsFens[THREADS_FEN_COUNT] = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -",
+  "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1"
+};
+
+// Mate puzzles taken from 'Chess' by Laszlo Polgar, as used in the mate tests.
+
+#define MATE_SETS  2
+#define MATE_COUNT 10
+
+static char *mateFens[MATE_SETS][MATE_COUNT] = {
+  {
+    "3q1rk1/5pbp/5Qp1/8/8/2B5/5PPP/6K1 w - -",
+    "2r2rk1/2q2p1p/6pQ/4P1N1/8/8/1PP5/2KR4 w - -",
+    "r2q1rk1/pp1p1p1p/5PpQ/8/4N3/8/PP3PPP/R5K1 w - -",
+    "6r1/7k/2p1pPp1/3p4/8/1R6/5PPP/5K2 w - -",
+    "1r4k1/1q3p2/5Bp1/8/8/8/PP6/1K5R w - -",
+    "r4rk1/5p1p/8/8/8/8/1BP5/2KR4 w - -",
+    "4r2k/4r1p1/6p1/8/2B5/8/1PP5/2KR4 w - -",
+    "8/2r1N1pk/8/8/8/2q2p2/2P5/2KR4 w - -",
+    "r7/4KNkp/8/8/B7/8/8/1R6 w - -",
+    "2kr4/3n4/2p5/8/5B2/8/6PP/5B1K w - -"
+  },
+  {
+    "1Q6/8/8/8/8/k2K4/8/8 w - -",
+    "8/8/8/8/8/k2K4/7Q/8 w - -",
+    "8/8/k1K3Q1/8/8/8/8/8 w - -",
+    "8/8/8/8/8/6KQ/8/4n1k1 w - -",
+    "8/8/2p5/2Q5/7k/5K2/8/8 w - -",
+    "4K2k/8/5N2/4Q3/8/8/8/8 w - -",
+    "5K1k/8/8/6N1/8/3p4/8/1B6 w - -",
+    "8/8/8/6N1/8/4K3/7k/5Q2 w - -",
+    "8/8/8/8/8/K3Q3/B1k5/8 w - -",
+    "8/5Q2/8/8/5p2/5K2/8/5k2 w - -"
+  }
+};
+
+// Search depth in plies required to see each set's mates.
+static int mateDepths[MATE_SETS] = { 1, 3 };
+
+// Position, limits and thread count RunBench searches operate on, and the last search's value.
+static Game         searchGame;
+static SearchLimits searchLimits;
+static int          searchThreadCount, searchValue;
+
+static BenchStats benchSearch(char*, int, int, uint64_t);
+static int64_t    runSearch(void);
+
+// Compare the nodes needed to reach fixed depths with and without killer and history move
+// ordering, over both the threads and tactical position sets.
+void
+BenchMoveOrdering()
+{
+  BenchStats stats;
+  char tmp[200];
+  char *fen;
+  double totalElapsed[2];
+  int depth, i, use;
+  uint64_t totalNodes[2];
+
+  ResizeTrans(SEARCH_BENCH_SIZE_MB);
+
+  for(depth = ORDERING_MIN_DEPTH; depth <= ORDERING_MAX_DEPTH; depth++) {
+    for(use = 0; use <= 1; use++) {
+      totalElapsed[use] = 0;
+      totalNodes[use] = 0;
+      UseHistoryOrdering(use);
+
+      for(i = 0; i < THREADS_FEN_COUNT + TACTICAL_COUNT; i++) {
+        fen = i < THREADS_FEN_COUNT ? threadsFens[i] : tacticalFens[i - THREADS_FEN_COUNT];
+        stats = benchSearch(fen, depth, 1, 0);
+
+        totalElapsed[use] += stats.Median;
+        totalNodes[use] += stats.Nodes;
+
+        sprintf(tmp, "Move Ordering Position %d Depth %d%s", i+1, depth,
+                use ? " Killers/History" : "");
+        OutputBenchStats(tmp, &stats);
+      }
+    }
+
+    printf("Killers/history at depth %d searched %lu of %lu nodes (%.1f%% fewer), "
+           "speedup %.3fx\n", depth, totalNodes[1], totalNodes[0],
+           100.0*(totalNodes[0] - totalNodes[1])/totalNodes[0], totalElapsed[0]/totalElapsed[1]);
+  }
+
+  UseHistoryOrdering(true);
+}
+
+// Measure the time taken to find each mate from an empty transposition table, and the node rate
+// achieved doing so.
+void
+BenchSearch()
+{
+  BenchStats stats;
+  char tmp[200];
+  double totalElapsed;
+  int i, j;
+  uint64_t totalNodes;
+
+  ResizeTrans(SEARCH_BENCH_SIZE_MB);
+
+  for(i = 0; i < MATE_SETS; i++) {
+    totalElapsed = 0;
+    totalNodes = 0;
+
+    for(j = 0; j < MATE_COUNT; j++) {
+      stats = benchSearch(mateFens[i][j], mateDepths[i], 1, 0);
+
+      totalElapsed += stats.Median;
+      totalNodes += stats.Nodes;
+
+      sprintf(tmp, "Mate in %d Position %d%s", i+1, j+1,
+              searchValue >= MATE_BOUND ? "" : " (MISSED)");
+      OutputBenchStats(tmp, &stats);
+    }
+
+    printf("Mate in %d Total:\t%.3f\tms to mate\t%.3f\tMn/s\n", i+1, totalElapsed,
+           1E-3*totalNodes/totalElapsed);
+  }
+}
+
+// Measure time to reach a fixed depth with increasing numbers of threads.
+void
+BenchSearchThreads()
+{
+  BenchStats stats;
+  char tmp[200];
+  double totalElapsed[THREAD_COUNTS];
+  int i, j;
+
+  ResizeTrans(SEARCH_BENCH_SIZE_MB);
+
+  for(i = 0; i < THREAD_COUNTS; i++) {
+    totalElapsed[i] = 0;
+
+    for(j = 0; j < THREADS_FEN_COUNT; j++) {
+      stats = benchSearch(threadsFens[j], THREADS_DEPTH, threadCounts[i], 0);
+
+      totalElapsed[i] += stats.Median;
+
+      sprintf(tmp, "Search Position %d Depth %d Threads %d", j+1, THREADS_DEPTH,
+              threadCounts[i]);
+      OutputBenchStats(tmp, &stats);
+    }
+
+    printf("Time to Depth %d Speedup, %d Threads:\t%.3fx\n", THREADS_DEPTH, threadCounts[i],
+           totalElapsed[0]/totalElapsed[i]);
+  }
+}
+
+// Search tactical positions with and without skipping losing captures in quiescence search. Every
+// node bar the root is the result of a DoMove, so the difference in nodes is the number of DoMove
+// calls SEE avoids.
+void
+BenchSeePruning()
+{
+  BenchStats stats;
+  char tmp[200];
+  double totalElapsed[2] = { 0, 0 };
+  int i, prune;
+  uint64_t totalNodes[2] = { 0, 0 };
+
+  ResizeTrans(SEARCH_BENCH_SIZE_MB);
+
+  for(i = 0; i < TACTICAL_COUNT; i++) {
+    for(prune = 0; prune <= 1; prune++) {
+      UseSeePruning(prune);
+      stats = benchSearch(tacticalFens[i], TACTICAL_DEPTH, 1, 0);
+
+      totalElapsed[prune] += stats.Median;
+      totalNodes[prune] += stats.Nodes;
+
+      sprintf(tmp, "Tactical Position %d Depth %d%s", i+1, TACTICAL_DEPTH,
+              prune ? " SEE Pruning" : "");
+      OutputBenchStats(tmp, &stats);
+    }
+  }
+
+  UseSeePruning(true);
+
+  printf("SEE Pruning avoided %lu of %lu DoMove calls (%.1f%%), speedup %.3fx\n",
+         totalNodes[0] - totalNodes[1], totalNodes[0],
+         100.0*(totalNodes[0] - totalNodes[1])/totalNodes[0], totalElapsed[0]/totalElapsed[1]);
+}
+
+// Check how closely time, node and default limits are kept to, and measure the per-node cost of
+// running a fixed depth search with the monitor thread active versus without.
+void
+BenchTimeControl()
+{
+  BenchStats stats;
+  char tmp[200];
+  double elapsed, monitored = 0, unmonitored = 0;
+  Game game;
+  int i, value;
+  SearchLimits limits;
+  uint64_t nodes, start, totalNodes = 0;
+
+  ResizeTrans(SEARCH_BENCH_SIZE_MB);
+
+  for(i = 0; i < TIME_LIMITS; i++) {
+    game = ParseFen(threadsFens[1]);
+    ClearTrans();
+    limits.Depth = 0;
+    limits.Nodes = 0;
+    limits.Millis = timeLimits[i];
+    nodes = 0;
+
+    start = NanoTime();
+    SearchLimited(&game, &limits, &nodes, &value, 1);
+    elapsed = 1E-6*(NanoTime() - start);
+
+    printf("Time Limit %lu ms:\t%.3f\tms\t%lu\tnodes\n", timeLimits[i], elapsed, nodes);
+  }
+
+  for(i = 0; i < NODE_LIMITS; i++) {
+    game = ParseFen(threadsFens[1]);
+    ClearTrans();
+    limits.Depth = 0;
+    limits.Nodes = nodeLimits[i];
+    limits.Millis = 0;
+    nodes = 0;
+
+    start = NanoTime();
+    SearchLimited(&game, &limits, &nodes, &value, 1);
+    elapsed = 1E-6*(NanoTime() - start);
+
+    printf("Node Limit %lu:\t%.3f\tms\t%lu\tnodes\n", nodeLimits[i], elapsed, nodes);
+  }
+
+  game = ParseFen(threadsFens[1]);
+  ClearTrans();
+  nodes = 0;
+
+  start = NanoTime();
+  SearchLimited(&game, NULL, &nodes, &value, 1);
+  elapsed = 1E-6*(NanoTime() - start);
+
+  printf("Default Limit %d s:\t%.3f\tms\t%lu\tnodes\n", MAX_THINK_SECS, elapsed, nodes);
+
+  for(i = 0; i < THREADS_FEN_COUNT; i++) {
+    // A time limit we'll never reach, so the monitor runs throughout.
+    stats = benchSearch(threadsFens[i], OVERHEAD_DEPTH, 1, 1000000);
+    monitored += stats.Median;
+
+    stats = benchSearch(threadsFens[i], OVERHEAD_DEPTH, 1, 0);
+    unmonitored += stats.Median;
+    totalNodes += stats.Nodes;
+
+    sprintf(tmp, "Search Position %d Depth %d", i+1, OVERHEAD_DEPTH);
+    OutputBenchStats(tmp, &stats);
+  }
+
+  printf("Monitor Thread Overhead:\t%.2f\tns/node\n", 1E6*(monitored - unmonitored)/totalNodes);
+}
+
+// Search the specified position with RunBench(), from an empty transposition table each time,
+// with the specified depth, thread count and time limit. The stats aren't output, so the caller
+// can name them.
+static BenchStats
+benchSearch(char *fen, int depth, int threads, uint64_t millis)
+{
+  BenchStats ret;
+
+  searchGame = ParseFen(fen);
+  searchLimits.Depth = depth;
+  searchLimits.Nodes = 0;
+  searchLimits.Millis = millis;
+  searchThreadCount = threads;
+
+  ret = RunBenchSetup(ClearTrans, runSearch);
+
+  ReleaseGame(&searchGame);
+
+  return ret;
+}
+
+static int64_t
+runSearch()
+{
+  uint64_t nodes = 0;
+
+  SearchLimited(&searchGame, &searchLimits, &nodes, &searchValue, searchThreadCount);
+
+  return (int64_t)nodes;
+}
@@ -0,0 +1,145 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include "../weak.h"
+#include "bench.h"
+
+#if defined(QUICK_BENCH)
+#define LATENCY_PROBES (C64(1)<<20)
+#else
+#define LATENCY_PROBES (C64(1)<<22)
+#endif
+
+// Large enough that the table's pages cannot all be covered by the TLB.
+#define LATENCY_SIZE_MB 1024
+
+#define THROUGHPUT_SIZES 5
+
+static const uint64_t throughputSizesMb[THROUGHPUT_SIZES] = { 1, 16, 128, 512, 1024 };
+
+static double elapsedMs(struct timespec*, struct timespec*);
+
+// Measure transposition table probe throughput at a range of table sizes. Probes are
+// independent of one another, so the processor is free to overlap their cache misses.
+void
+BenchTransProbes()
+{
+  char tmp[200];
+  double elapsed;
+  int i;
+  struct timespec end, start;
+  TransEntry entry;
+  uint64_t found, j;
+  uint64_t *keys = allocate(sizeof(uint64_t), LATENCY_PROBES);
+
+  for(j = 0; j < LATENCY_PROBES; j++) {
+    keys[j] = randk();
+  }
+
+  for(i = 0; i < THROUGHPUT_SIZES; i++) {
+    ResizeTrans(throughputSizesMb[i]);
+    ClearTrans();
+
+    for(j = 0; j < LATENCY_PROBES; j++) {
+      SavePosition(keys[j], (int64_t)j, INVALID_MOVE, 1, ExactBound);
+    }
+
+    found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(j = 0; j < LATENCY_PROBES; j++) {
+      if(LookupPosition(keys[j], &entry)) {
+        found++;
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = elapsedMs(&start, &end);
+
+    sprintf(tmp, "Trans Probes %lu MB", throughputSizesMb[i]);
+    printf("%s:\t%.1f\tMprobes/s\t%.1f%%\thit\n", tmp, LATENCY_PROBES/(1E3*elapsed),
+           100.0*found/LATENCY_PROBES);
+  }
+
+  release(keys);
+}
+
+// Measure transposition table probe latency with and without huge pages. Each probe depends on
+// the result of the previous one, so probes cannot overlap and we see the full cost of each
+// cache and TLB miss.
+void
+BenchTransLatency()
+{
+  char tmp[200];
+  double clearElapsed, elapsed;
+  int huge;
+  struct timespec end, start;
+  TransEntry entry;
+  uint64_t i, next;
+  uint64_t *keys = allocate(sizeof(uint64_t), LATENCY_PROBES);
+
+  for(huge = 0; huge <= 1; huge++) {
+    UseHugePages(huge);
+
+    // Force a fresh allocation, timing the parallel first-touch clear.
+    ResizeTrans(1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ResizeTrans(LATENCY_SIZE_MB);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    clearElapsed = elapsedMs(&start, &end);
+
+    // Chain keys together - each entry's value is the index of the next key to look up.
+    for(i = 0; i < LATENCY_PROBES; i++) {
+      keys[i] = randk();
+      SavePosition(keys[i], (int64_t)((i + 1) % LATENCY_PROBES), INVALID_MOVE, 1, ExactBound);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    next = 0;
+    for(i = 0; i < LATENCY_PROBES; i++) {
+      // Entries may have been replaced by later keys. If so, just carry on.
+      if(LookupPosition(keys[next], &entry)) {
+        next = (uint64_t)entry.Value;
+      } else {
+        next = (next + 1) % LATENCY_PROBES;
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = elapsedMs(&start, &end);
+
+    sprintf(tmp, "Trans Probe Latency %d MB%s", LATENCY_SIZE_MB, huge ? " Huge Pages" : "");
+    printf("%s:\t%.1f\tns/probe\t%.1f\tms alloc+clear\n", tmp, 1E6*elapsed/LATENCY_PROBES,
+           clearElapsed);
+  }
+
+  // Make sure the chain can't be optimised away.
+  if(next == LATENCY_PROBES) {
+    puts("Impossible.");
+  }
+
+  release(keys);
+}
+
+static double
+elapsedMs(struct timespec *start, struct timespec *end)
+{
+  return 1E3*(end->tv_sec - start->tv_sec) + 1E-6*(end->tv_nsec - start->tv_nsec);
+}
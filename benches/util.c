@@ -19,13 +19,33 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "bench.h"
 
+typedef struct BenchRecord BenchRecord;
+struct BenchRecord {
+  char *Name;
+  BenchStats Stats;
+};
+
+static BenchRecord *records;
+static int recordCount, recordCap;
+
+static int    compareDoubles(const void*, const void*);
+static void   outputCounters(BenchStats*);
+static double percentile(double*, int, double);
+static void   record(char*, BenchStats*);
+static double timeIters(void (*)(void), int64_t (*)(void), long, int64_t*);
+
 void
 OutputBenchResults(char *name, double elapsed, long iters, int64_t nodes)
 {
+  BenchStats stats;
+
   printf("%s:\t%ld\t%.3f\tms/op", name, iters, elapsed/iters);
 
   // Not all benchmarks will necessarily return node count, if not they each return -1.
@@ -34,4 +54,239 @@ OutputBenchResults(char *name, double elapsed, long iters, int64_t nodes)
   }
 
   printf("\n");
+
+  // Single measurement, so no spread - WriteBenchJson() omits it.
+  stats.Median = stats.P10 = stats.P90 = stats.Mean = elapsed/iters;
+  stats.StdDev = 0;
+  // Not measured.
+  memset(&stats.Counters, 0, sizeof(BenchCounters));
+  stats.Iters = iters;
+  stats.Nodes = nodes;
+  stats.Runs = 1;
+  record(name, &stats);
+}
+
+void
+OutputBenchStats(char *name, BenchStats *stats)
+{
+  printf("%s:\t%ld\t%.3f\tms/op", name, stats->Iters, stats->Median);
+
+  if(stats->Nodes > 0) {
+    printf("\t%.3f\tMn/s", 1E-3*stats->Nodes/stats->Median);
+  }
+
+  printf("\t[p10 %.3f p90 %.3f sd %.3f n=%d]", stats->P10, stats->P90, stats->StdDev,
+         stats->Runs);
+
+  outputCounters(stats);
+
+  printf("\n");
+
+  record(name, stats);
+}
+
+// Run fn repeatedly, returning ms/op statistics over BENCH_RUNS timed runs. The
+// iteration count is doubled until a single run takes at least MIN_ELAPSED ms, then
+// BENCH_WARMUP_RUNS further runs are discarded before measuring.
+BenchStats
+RunBench(int64_t (*fn)(void))
+{
+  return RunBenchSetup(NULL, fn);
+}
+
+// RunBench(), calling setup before every call to fn, e.g. to clear the transposition table.
+// Only fn is timed, though hardware counters include setup too. Each call is timed on its own, so
+// every run is a single call rather than repeating an expensive setup to fill MIN_ELAPSED.
+BenchStats
+RunBenchSetup(void (*setup)(void), int64_t (*fn)(void))
+{
+  BenchStats ret;
+  double samples[BENCH_RUNS], sumSquares, total;
+  int i;
+  int64_t nodes = 0;
+  long iters;
+
+  // Calibrate.
+  iters = 1;
+  while(setup == NULL && timeIters(setup, fn, iters, &nodes) < MIN_ELAPSED) {
+    iters *= 2;
+  }
+
+  for(i = 0; i < BENCH_WARMUP_RUNS; i++) {
+    timeIters(setup, fn, iters, &nodes);
+  }
+
+  total = 0;
+  StartCounters();
+  for(i = 0; i < BENCH_RUNS; i++) {
+    samples[i] = timeIters(setup, fn, iters, &nodes)/iters;
+    total += samples[i];
+  }
+  StopCounters(&ret.Counters);
+
+  ret.Mean = total/BENCH_RUNS;
+  sumSquares = 0;
+  for(i = 0; i < BENCH_RUNS; i++) {
+    sumSquares += (samples[i] - ret.Mean)*(samples[i] - ret.Mean);
+  }
+  ret.StdDev = BENCH_RUNS > 1 ? sqrt(sumSquares/(BENCH_RUNS - 1)) : 0;
+
+  qsort(samples, BENCH_RUNS, sizeof(double), compareDoubles);
+  ret.Median = percentile(samples, BENCH_RUNS, 0.5);
+  ret.P10 = percentile(samples, BENCH_RUNS, 0.1);
+  ret.P90 = percentile(samples, BENCH_RUNS, 0.9);
+
+  ret.Iters = iters;
+  ret.Nodes = nodes;
+  ret.Runs = BENCH_RUNS;
+
+  return ret;
+}
+
+// Write all results output so far to path as JSON.
+void
+WriteBenchJson(char *path)
+{
+  BenchCounter counter;
+  BenchStats *stats;
+  char *c;
+  double ops;
+  FILE *file;
+  int i;
+
+  if((file = fopen(path, "w")) == NULL) {
+    panic("Unable to open %s for writing.", path);
+  }
+
+  fprintf(file, "{\n  \"version\": \"%s\",\n  \"timestamp\": %ld,\n", version,
+          (long)time(NULL));
+  fprintf(file, "  \"warmup_runs\": %d,\n  \"results\": [", BENCH_WARMUP_RUNS);
+
+  for(i = 0; i < recordCount; i++) {
+    stats = &records[i].Stats;
+
+    fprintf(file, "%s\n    {\"name\": \"", i > 0 ? "," : "");
+    // Names are our own, only quotes and backslashes need escaping.
+    for(c = records[i].Name; *c; c++) {
+      if(*c == '"' || *c == '\\') {
+        fputc('\\', file);
+      }
+      fputc(*c, file);
+    }
+    fprintf(file, "\", \"runs\": %d, \"iters\": %ld, ", stats->Runs, stats->Iters);
+    fprintf(file, "\"median_ms\": %.6f, \"mean_ms\": %.6f, ", stats->Median, stats->Mean);
+    // A single run has no spread to report.
+    if(stats->Runs > 1) {
+      fprintf(file, "\"p10_ms\": %.6f, \"p90_ms\": %.6f, \"stddev_ms\": %.6f, ",
+              stats->P10, stats->P90, stats->StdDev);
+    }
+    fprintf(file, "\"nodes\": %ld", (long)stats->Nodes);
+    if(stats->Nodes > 0) {
+      fprintf(file, ", \"mnps\": %.3f", 1E-3*stats->Nodes/stats->Median);
+    } else {
+      fprintf(file, ", \"mnps\": null");
+    }
+
+    // Counters are given per operation.
+    ops = (double)stats->Runs*stats->Iters;
+    for(counter = 0; counter < CounterCount; counter++) {
+      if(stats->Counters.Valid[counter]) {
+        fprintf(file, ", \"%s\": %.3f", CounterName(counter),
+                stats->Counters.Values[counter]/ops);
+      }
+    }
+    fprintf(file, "}");
+  }
+
+  fprintf(file, "\n  ]\n}\n");
+  fclose(file);
+}
+
+static int
+compareDoubles(const void *a, const void *b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+
+  return (x > y) - (x < y);
+}
+
+// Output IPC and, if the benchmark counts nodes, misses per node.
+static void
+outputCounters(BenchStats *stats)
+{
+  BenchCounters *counters = &stats->Counters;
+  BenchCounter counter;
+  double nodes = (double)stats->Runs*stats->Iters*stats->Nodes;
+
+  if(counters->Valid[CounterCycles] && counters->Valid[CounterInstructions] &&
+     counters->Values[CounterCycles] > 0) {
+    printf("\tIPC %.2f", (double)counters->Values[CounterInstructions]/
+           counters->Values[CounterCycles]);
+  }
+
+  if(stats->Nodes <= 0) {
+    return;
+  }
+
+  for(counter = CounterBranchMisses; counter < CounterCount; counter++) {
+    if(counters->Valid[counter]) {
+      printf("\t%s/n %.3f", CounterName(counter), counters->Values[counter]/nodes);
+    }
+  }
+}
+
+// Linearly interpolated percentile of sorted samples, p in [0, 1].
+static double
+percentile(double *sorted, int count, double p)
+{
+  double index = p*(count - 1);
+  int lower = (int)index;
+
+  if(lower >= count - 1) {
+    return sorted[count - 1];
+  }
+
+  return sorted[lower] + (index - lower)*(sorted[lower + 1] - sorted[lower]);
+}
+
+static void
+record(char *name, BenchStats *stats)
+{
+  if(recordCount == recordCap) {
+    recordCap = recordCap == 0 ? 64 : 2*recordCap;
+    if((records = realloc(records, recordCap*sizeof(BenchRecord))) == NULL) {
+      panic("Out of memory.");
+    }
+  }
+
+  records[recordCount].Name = strdup(name);
+  records[recordCount].Stats = *stats;
+  recordCount++;
+}
+
+// Call fn iters times, returning the time taken in ms. If setup is non-NULL it is called before
+// each call, untimed, so each call is timed individually. nodes is set to fn's last result.
+static double
+timeIters(void (*setup)(void), int64_t (*fn)(void), long iters, int64_t *nodes)
+{
+  long i;
+  uint64_t elapsed = 0, start;
+
+  if(setup == NULL) {
+    start = NanoTime();
+    for(i = 0; i < iters; i++) {
+      *nodes = fn();
+    }
+
+    return 1E-6*(NanoTime() - start);
+  }
+
+  for(i = 0; i < iters; i++) {
+    setup();
+    start = NanoTime();
+    *nodes = fn();
+    elapsed += NanoTime() - start;
+  }
+
+  return 1E-6*elapsed;
 }
@@ -0,0 +1,425 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "weak.h"
+
+// Distributed perft. A coordinator collects the unique frontier positions some plies below the
+// root and farms their perfts out to worker processes over pipes, one line per job:-
+//
+//   coordinator -> worker: <job> <depth> <fen>
+//   worker -> coordinator: <job> <count>
+//
+// Workers are either forked locally, or started with a shell command (e.g. ssh to another
+// machine running weak --worker), and exit when their input is closed.
+
+#define MAX_WORKERS 256
+// Jobs outstanding per worker, so a worker has its next job ready as soon as it replies.
+#define WORKER_QUEUE 2
+#define WORKER_LINE_LEN (MAX_FEN_LEN + 64)
+
+enum JobState {
+  JobPending,
+  JobSent,
+  JobDone
+};
+
+typedef enum JobState JobState;
+
+typedef struct Worker Worker;
+struct Worker {
+  pid_t Pid;
+  // Write jobs to In, read replies from Out.
+  int   In, Out;
+  bool  Alive;
+  int   Outstanding;
+  // Partial reply line.
+  char  Line[WORKER_LINE_LEN];
+  int   LineLength;
+};
+
+typedef struct Coordinator Coordinator;
+struct Coordinator {
+  Game      *Game;
+  Frontier   Frontier;
+  int        Depth;
+  JobState  *States;
+  // Which worker each sent job was sent to.
+  int       *Owners;
+  // Jobs to (re)send, as a stack.
+  int       *Pending;
+  int        PendingCount;
+  int        Done;
+  Worker     Workers[MAX_WORKERS];
+  int        WorkerCount;
+  Uint128    Total;
+};
+
+static void killWorker(Coordinator*, int);
+static bool readReplies(Coordinator*, int);
+static bool sendJob(Coordinator*, int);
+static bool startWorker(Coordinator*, int, char*, bool);
+
+// Perft of the current position to depth across the specified number of worker processes. The
+// frontier split plies down is deduplicated by hash, and each unique position's perft to the
+// remaining depth is computed by a worker and weighted by how many times it occurs. Workers are
+// started with command via /bin/sh if it is non-NULL, otherwise forked from this process,
+// counting with HashPerft() if hash is set. If stats is non-NULL, the size of the frontier is
+// stored there. Returns false, having printed the reason to stderr, if the work couldn't be
+// completed, e.g. because every worker died.
+bool
+DistributedPerft(Game *game, int depth, int split, int workers, char *command, bool hash,
+                 Uint128 *ret, FrontierStats *stats)
+{
+  bool ok = true;
+  Coordinator coordinator;
+  int i, status, w;
+  struct pollfd fds[MAX_WORKERS];
+  int fdWorkers[MAX_WORKERS];
+  int pollCount;
+  void (*oldPipeHandler)(int);
+
+  ret->Hi = 0;
+  ret->Lo = 0;
+  if(stats != NULL) {
+    stats->Count = 0;
+  }
+
+  if(split < 1 || split >= depth) {
+    ret->Lo = QuickPerft(game, depth);
+    return true;
+  }
+  if(split > MAX_FRONTIER_DEPTH) {
+    split = MAX_FRONTIER_DEPTH;
+  }
+  if(workers < 1) {
+    workers = 1;
+  } else if(workers > MAX_WORKERS) {
+    workers = MAX_WORKERS;
+  }
+
+  coordinator.Game = game;
+  coordinator.Depth = depth;
+  coordinator.Frontier = CollectFrontier(game, split);
+  coordinator.States = (JobState*)allocate(sizeof(JobState), coordinator.Frontier.Count);
+  coordinator.Owners = (int*)allocate(sizeof(int), coordinator.Frontier.Count);
+  coordinator.Pending = (int*)allocate(sizeof(int), coordinator.Frontier.Count);
+  coordinator.PendingCount = coordinator.Frontier.Count;
+  coordinator.Done = 0;
+  coordinator.WorkerCount = 0;
+  coordinator.Total.Hi = 0;
+  coordinator.Total.Lo = 0;
+
+  // Pop jobs in frontier order.
+  for(i = 0; i < coordinator.Frontier.Count; i++) {
+    coordinator.States[i] = JobPending;
+    coordinator.Pending[i] = coordinator.Frontier.Count - 1 - i;
+  }
+
+  if(stats != NULL) {
+    stats->Count = coordinator.Frontier.Count;
+    stats->Depth = split;
+    stats->Positions = coordinator.Frontier.Positions;
+  }
+
+  // A dead worker shows up as a failed write rather than killing us.
+  oldPipeHandler = signal(SIGPIPE, SIG_IGN);
+
+  for(w = 0; w < workers; w++) {
+    if(startWorker(&coordinator, w, command, hash)) {
+      coordinator.WorkerCount = w + 1;
+    } else {
+      break;
+    }
+  }
+
+  while(coordinator.Done < coordinator.Frontier.Count) {
+    pollCount = 0;
+
+    for(w = 0; w < coordinator.WorkerCount; w++) {
+      while(coordinator.Workers[w].Alive && coordinator.Workers[w].Outstanding < WORKER_QUEUE &&
+            coordinator.PendingCount > 0) {
+        if(!sendJob(&coordinator, w)) {
+          killWorker(&coordinator, w);
+        }
+      }
+
+      if(coordinator.Workers[w].Alive) {
+        fds[pollCount].fd = coordinator.Workers[w].Out;
+        fds[pollCount].events = POLLIN;
+        fdWorkers[pollCount++] = w;
+      }
+    }
+
+    if(pollCount == 0) {
+      fprintf(stderr, "No workers left, %d of %d jobs unfinished.\n",
+              coordinator.Frontier.Count - coordinator.Done, coordinator.Frontier.Count);
+      ok = false;
+      break;
+    }
+
+    if(poll(fds, pollCount, -1) < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Polling workers failed: %s.\n", strerror(errno));
+      ok = false;
+      break;
+    }
+
+    for(i = 0; i < pollCount; i++) {
+      if(fds[i].revents != 0 && !readReplies(&coordinator, fdWorkers[i])) {
+        killWorker(&coordinator, fdWorkers[i]);
+      }
+    }
+  }
+
+  // Closing their input tells the remaining workers to exit.
+  for(w = 0; w < coordinator.WorkerCount; w++) {
+    if(coordinator.Workers[w].Alive) {
+      close(coordinator.Workers[w].In);
+      close(coordinator.Workers[w].Out);
+    }
+    waitpid(coordinator.Workers[w].Pid, &status, 0);
+  }
+
+  signal(SIGPIPE, oldPipeHandler);
+
+  *ret = coordinator.Total;
+
+  release(coordinator.States);
+  release(coordinator.Owners);
+  release(coordinator.Pending);
+  ReleaseFrontier(&coordinator.Frontier);
+
+  return ok;
+}
+
+// Serve perft jobs read from the in file descriptor, replying to out, until in is closed.
+void
+PerftWorker(int in, int out, bool hash)
+{
+  char line[WORKER_LINE_LEN];
+  FenError error;
+  FILE *input = fdopen(in, "r"), *output = fdopen(out, "w");
+  Game game = NewEmptyGame(false, White);
+  int depth, id, offset;
+  size_t len;
+  uint64_t count;
+
+  if(input == NULL || output == NULL) {
+    panic("Unable to open worker streams.");
+  }
+
+  while(fgets(line, sizeof(line), input) != NULL) {
+    if(sscanf(line, "%d %d %n", &id, &depth, &offset) != 2) {
+      panic("Invalid worker job '%s'.", line);
+    }
+
+    len = strcspn(line + offset, "\n");
+    if((error = ParseFenInto(&game, line + offset, len)) != FenOk) {
+      panic("Invalid worker job '%s' - %s.", line, StringFenError(error));
+    }
+
+    count = hash ? HashPerft(&game, depth, true) : QuickPerft(&game, depth);
+
+    fprintf(output, "%d %lu\n", id, count);
+    if(fflush(output) != 0) {
+      // The coordinator has gone away.
+      break;
+    }
+  }
+
+  ReleaseGame(&game);
+  fclose(input);
+  fclose(output);
+}
+
+// Give up on a worker, putting any jobs it had back on the pending stack.
+static void
+killWorker(Coordinator *coordinator, int w)
+{
+  int i;
+  Worker *worker = &coordinator->Workers[w];
+
+  if(!worker->Alive) {
+    return;
+  }
+
+  fprintf(stderr, "Lost worker %d.\n", w);
+
+  worker->Alive = false;
+  close(worker->In);
+  close(worker->Out);
+  kill(worker->Pid, SIGTERM);
+
+  for(i = 0; i < coordinator->Frontier.Count; i++) {
+    if(coordinator->States[i] == JobSent && coordinator->Owners[i] == w) {
+      coordinator->States[i] = JobPending;
+      coordinator->Pending[coordinator->PendingCount++] = i;
+    }
+  }
+  worker->Outstanding = 0;
+}
+
+// Read whatever a worker has sent, accumulating any complete replies. Returns false if the worker
+// has gone away or sent something we didn't ask for.
+static bool
+readReplies(Coordinator *coordinator, int w)
+{
+  char *end, *line;
+  int id;
+  ssize_t n;
+  unsigned long count;
+  Worker *worker = &coordinator->Workers[w];
+
+  n = read(worker->Out, worker->Line + worker->LineLength,
+           WORKER_LINE_LEN - 1 - worker->LineLength);
+  if(n <= 0) {
+    return n < 0 && errno == EINTR;
+  }
+  worker->LineLength += n;
+  worker->Line[worker->LineLength] = '\0';
+
+  line = worker->Line;
+  while((end = strchr(line, '\n')) != NULL) {
+    *end = '\0';
+
+    if(sscanf(line, "%d %lu", &id, &count) != 2 || id < 0 || id >= coordinator->Frontier.Count ||
+       coordinator->States[id] != JobSent || coordinator->Owners[id] != w) {
+      return false;
+    }
+
+    coordinator->States[id] = JobDone;
+    coordinator->Done++;
+    worker->Outstanding--;
+    AddProductUint128(&coordinator->Total, count, coordinator->Frontier.Entries[id].Multiplicity);
+
+    line = end + 1;
+  }
+
+  // Keep any partial line for next time.
+  worker->LineLength = strlen(line);
+  memmove(worker->Line, line, worker->LineLength + 1);
+
+  // A full buffer without a newline isn't a reply.
+  return worker->LineLength < WORKER_LINE_LEN - 1;
+}
+
+// Send the next pending job to a worker. Returns false if it can't be written.
+static bool
+sendJob(Coordinator *coordinator, int w)
+{
+  char fen[MAX_FEN_LEN], line[WORKER_LINE_LEN];
+  int id = coordinator->Pending[--coordinator->PendingCount], len, i;
+  Worker *worker = &coordinator->Workers[w];
+
+  PlayFrontierEntry(coordinator->Game, &coordinator->Frontier, id);
+  WriteFen(coordinator->Game, fen);
+  for(i = 0; i < coordinator->Frontier.Depth; i++) {
+    Unmove(coordinator->Game);
+  }
+
+  coordinator->States[id] = JobSent;
+  coordinator->Owners[id] = w;
+  worker->Outstanding++;
+
+  len = sprintf(line, "%d %d %s\n", id, coordinator->Depth - coordinator->Frontier.Depth, fen);
+
+  // Pipe writes this small are atomic.
+  return write(worker->In, line, len) == len;
+}
+
+// Start worker w, connected to us by a pair of pipes.
+static bool
+startWorker(Coordinator *coordinator, int w, char *command, bool hash)
+{
+  int i, toWorker[2], fromWorker[2];
+  pid_t pid;
+  Worker *worker = &coordinator->Workers[w];
+
+  if(pipe(toWorker) != 0) {
+    return false;
+  }
+  if(pipe(fromWorker) != 0) {
+    close(toWorker[0]);
+    close(toWorker[1]);
+    return false;
+  }
+
+  // Flush now so buffered output isn't duplicated in the child.
+  fflush(stdout);
+  fflush(stderr);
+
+  if((pid = fork()) < 0) {
+    close(toWorker[0]);
+    close(toWorker[1]);
+    close(fromWorker[0]);
+    close(fromWorker[1]);
+    return false;
+  }
+
+  if(pid == 0) {
+    // Ignored signals stay ignored across exec, and a worker should die with its coordinator.
+    signal(SIGPIPE, SIG_DFL);
+
+    // Otherwise earlier workers never see their input close.
+    for(i = 0; i < w; i++) {
+      if(coordinator->Workers[i].Alive) {
+        close(coordinator->Workers[i].In);
+        close(coordinator->Workers[i].Out);
+      }
+    }
+    close(toWorker[1]);
+    close(fromWorker[0]);
+
+    if(command != NULL) {
+      dup2(toWorker[0], STDIN_FILENO);
+      dup2(fromWorker[1], STDOUT_FILENO);
+      close(toWorker[0]);
+      close(fromWorker[1]);
+      execl("/bin/sh", "sh", "-c", command, (char*)NULL);
+      _exit(127);
+    }
+
+    PerftWorker(toWorker[0], fromWorker[1], hash);
+    _exit(0);
+  }
+
+  close(toWorker[0]);
+  close(fromWorker[1]);
+
+  worker->Pid = pid;
+  worker->In = toWorker[1];
+  worker->Out = fromWorker[0];
+  worker->Alive = true;
+  worker->Outstanding = 0;
+  worker->LineLength = 0;
+
+  return true;
+}
@@ -0,0 +1,216 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "weak.h"
+#include "magic.h"
+
+// Piece values in centipawns, indexed by Piece.
+static const int pieceValues[7] = { 0, 100, 300, 300, 500, 900, 0 };
+
+// Longest possible exchange on a square - every piece bar the kings, plus the kings.
+#define MAX_EXCHANGE 32
+
+// Piece-square bonuses from white's point of view, laid out as the board is viewed from white's
+// side, i.e. a8 first. Taken from Tomasz Michniewski's 'Simplified evaluation function'.
+static const int pieceSquareBonuses[7][64] = {
+  // MissingPiece.
+  { 0 },
+  // Pawn.
+  {   0,   0,   0,   0,   0,   0,   0,   0,
+     50,  50,  50,  50,  50,  50,  50,  50,
+     10,  10,  20,  30,  30,  20,  10,  10,
+      5,   5,  10,  25,  25,  10,   5,   5,
+      0,   0,   0,  20,  20,   0,   0,   0,
+      5,  -5, -10,   0,   0, -10,  -5,   5,
+      5,  10,  10, -20, -20,  10,  10,   5,
+      0,   0,   0,   0,   0,   0,   0,   0 },
+  // Knight.
+  { -50, -40, -30, -30, -30, -30, -40, -50,
+    -40, -20,   0,   0,   0,   0, -20, -40,
+    -30,   0,  10,  15,  15,  10,   0, -30,
+    -30,   5,  15,  20,  20,  15,   5, -30,
+    -30,   0,  15,  20,  20,  15,   0, -30,
+    -30,   5,  10,  15,  15,  10,   5, -30,
+    -40, -20,   0,   5,   5,   0, -20, -40,
+    -50, -40, -30, -30, -30, -30, -40, -50 },
+  // Bishop.
+  { -20, -10, -10, -10, -10, -10, -10, -20,
+    -10,   0,   0,   0,   0,   0,   0, -10,
+    -10,   0,   5,  10,  10,   5,   0, -10,
+    -10,   5,   5,  10,  10,   5,   5, -10,
+    -10,   0,  10,  10,  10,  10,   0, -10,
+    -10,  10,  10,  10,  10,  10,  10, -10,
+    -10,   5,   0,   0,   0,   0,   5, -10,
+    -20, -10, -10, -10, -10, -10, -10, -20 },
+  // Rook.
+  {   0,   0,   0,   0,   0,   0,   0,   0,
+      5,  10,  10,  10,  10,  10,  10,   5,
+     -5,   0,   0,   0,   0,   0,   0,  -5,
+     -5,   0,   0,   0,   0,   0,   0,  -5,
+     -5,   0,   0,   0,   0,   0,   0,  -5,
+     -5,   0,   0,   0,   0,   0,   0,  -5,
+     -5,   0,   0,   0,   0,   0,   0,  -5,
+      0,   0,   0,   5,   5,   0,   0,   0 },
+  // Queen.
+  { -20, -10, -10,  -5,  -5, -10, -10, -20,
+    -10,   0,   0,   0,   0,   0,   0, -10,
+    -10,   0,   5,   5,   5,   5,   0, -10,
+     -5,   0,   5,   5,   5,   5,   0,  -5,
+      0,   0,   5,   5,   5,   5,   0,  -5,
+    -10,   5,   5,   5,   5,   5,   0, -10,
+    -10,   0,   5,   0,   0,   0,   0, -10,
+    -20, -10, -10,  -5,  -5, -10, -10, -20 },
+  // King, middlegame.
+  { -30, -40, -40, -50, -50, -40, -40, -30,
+    -30, -40, -40, -50, -50, -40, -40, -30,
+    -30, -40, -40, -50, -50, -40, -40, -30,
+    -30, -40, -40, -50, -50, -40, -40, -30,
+    -20, -30, -30, -40, -40, -30, -30, -20,
+    -10, -20, -20, -20, -20, -20, -20, -10,
+     20,  20,   0,   0,   0,   0,  20,  20,
+     20,  30,  10,   0,   0,  10,  30,  20 }
+};
+
+// Evaluate the position from the point of view of the side to move. Currently material and
+// piece-square bonuses only, which are maintained incrementally in game->Score.
+int
+Evaluate(Game *game)
+{
+  return game->WhosTurn == White ? game->Score : -game->Score;
+}
+
+void
+InitEval()
+{
+  Piece piece;
+  Position pos;
+
+  for(piece = Pawn; piece <= King; piece++) {
+    for(pos = A1; pos <= H8; pos++) {
+      // The bonus tables start at a8, so flip the rank for white.
+      PieceSquareScores[White][piece][pos] = pieceValues[piece] + pieceSquareBonuses[piece][pos^56];
+      PieceSquareScores[Black][piece][pos] = -pieceValues[piece] - pieceSquareBonuses[piece][pos];
+    }
+  }
+}
+
+// Calculate game->Score from scratch.
+int
+ScoreGame(Game *game)
+{
+  BitBoard bitBoard;
+  Piece piece;
+  Side side;
+  int ret = 0;
+
+  for(side = White; side <= Black; side++) {
+    for(piece = Pawn; piece <= King; piece++) {
+      bitBoard = game->ChessSet.Sets[side].Boards[piece];
+
+      while(bitBoard) {
+        ret += PieceSquareScores[side][piece][PopForward(&bitBoard)];
+      }
+    }
+  }
+
+  return ret;
+}
+
+// Static exchange evaluation - determine the material gain or loss of the specified move, assuming
+// both sides then recapture on the destination square with their least valuable attacker for as
+// long as it benefits them. Pins are ignored.
+int
+See(Game *game, Move move)
+{
+  BitBoard attackers, bishopish, occupancy, rookish, sideAttackers;
+  ChessSet *chessSet = &game->ChessSet;
+  int i, swapList[MAX_EXCHANGE];
+  MoveType type = TYPE(move);
+  Piece attacker, onSquare;
+  Position from = FROM(move), to = TO(move);
+  Side side = game->WhosTurn;
+
+  // Castling can't lose material.
+  if(type == CastleKingSide || type == CastleQueenSide) {
+    return 0;
+  }
+
+  onSquare = PieceAt(chessSet, from);
+  occupancy = chessSet->Occupancy ^ POSBOARD(from);
+
+  if(type == EnPassant) {
+    swapList[0] = pieceValues[Pawn];
+    occupancy ^= POSBOARD(to + (side == White ? -8 : 8));
+  } else {
+    swapList[0] = pieceValues[PieceAt(chessSet, to)];
+  }
+
+  if(type&PromoteMask) {
+    onSquare = type - PromoteMask;
+    swapList[0] += pieceValues[onSquare] - pieceValues[Pawn];
+  }
+
+  bishopish = chessSet->PieceOccupancy[Bishop] | chessSet->PieceOccupancy[Queen];
+  rookish = chessSet->PieceOccupancy[Rook] | chessSet->PieceOccupancy[Queen];
+
+  attackers = AllAttackersTo(chessSet, to, occupancy) & occupancy;
+
+  for(i = 1; i < MAX_EXCHANGE; i++) {
+    side = OPPOSITE(side);
+    sideAttackers = attackers & chessSet->Sets[side].Occupancy;
+
+    if(!sideAttackers) {
+      break;
+    }
+
+    for(attacker = Pawn; !(sideAttackers&chessSet->Sets[side].Boards[attacker]); attacker++)
+      ;
+
+    // The king can only recapture if the square is no longer defended.
+    if(attacker == King && (attackers&chessSet->Sets[OPPOSITE(side)].Occupancy)) {
+      break;
+    }
+
+    swapList[i] = pieceValues[onSquare] - swapList[i-1];
+    onSquare = attacker;
+
+    occupancy ^= POSBOARD(BitScanForward(sideAttackers&chessSet->Sets[side].Boards[attacker]));
+
+    // Removing the attacker might reveal a slider behind it.
+    if(attacker == Pawn || attacker == Bishop || attacker == Queen) {
+      attackers |= BishopAttacksFrom(to, occupancy) & bishopish;
+    }
+    if(attacker == Rook || attacker == Queen) {
+      attackers |= RookAttacksFrom(to, occupancy) & rookish;
+    }
+    attackers &= occupancy;
+  }
+
+  // Each side can choose to stop capturing rather than continue the exchange, so negamax the
+  // swap list back to the first capture.
+  while(--i > 0) {
+    if(-swapList[i] < swapList[i-1]) {
+      swapList[i-1] = -swapList[i];
+    }
+  }
+
+  return swapList[0];
+}
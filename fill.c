@@ -0,0 +1,130 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Set-wise sliding attacks via Kogge-Stone fills, see
+// http://chessprogramming.wikispaces.com/Kogge-Stone+Algorithm. Rather than looking up each
+// slider's attacks in turn, every slider is flooded along each direction at once in 3 shift
+// steps, which the AVX2 kernel does 4 directions at a time.
+
+#include "weak.h"
+
+#if defined(USE_AVX2) && defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_AVX2_FILL
+#include <immintrin.h>
+#endif
+
+static bool useAvx2;
+
+#if defined(HAVE_AVX2_FILL)
+static BitBoard avx2Fill(BitBoard, BitBoard, BitBoard);
+#endif
+
+// Determine which fill SlidingAttacks() uses. Set vectorise to use the AVX2 kernel where this
+// build and the processor support it. Returns whether it is in use.
+bool
+InitSlidingAttacks(bool vectorise)
+{
+#if defined(HAVE_AVX2_FILL)
+  useAvx2 = vectorise && CpuHasAvx2();
+#else
+  (void)vectorise;
+  useAvx2 = false;
+#endif
+
+  return useAvx2;
+}
+
+// Determine every square attacked by the specified rook-like and bishop-like sliders, given the
+// specified occupancy.
+BitBoard
+SlidingAttacks(BitBoard rookish, BitBoard bishopish, BitBoard occupancy)
+{
+#if defined(HAVE_AVX2_FILL)
+  if(useAvx2) {
+    return avx2Fill(rookish, bishopish, occupancy);
+  }
+#endif
+
+  return SlidingAttacksScalar(rookish, bishopish, occupancy);
+}
+
+// SlidingAttacks() one direction at a time, for processors without AVX2.
+BitBoard
+SlidingAttacksScalar(BitBoard rookish, BitBoard bishopish, BitBoard occupancy)
+{
+  BitBoard empty = ~occupancy;
+
+  return FillAttacksUp(rookish, empty, 8, FullyOccupied) |
+    FillAttacksUp(rookish, empty, 1, NotFileAMask) |
+    FillAttacksUp(bishopish, empty, 9, NotFileAMask) |
+    FillAttacksUp(bishopish, empty, 7, NotFileHMask) |
+    FillAttacksDown(rookish, empty, 8, FullyOccupied) |
+    FillAttacksDown(rookish, empty, 1, NotFileHMask) |
+    FillAttacksDown(bishopish, empty, 9, NotFileHMask) |
+    FillAttacksDown(bishopish, empty, 7, NotFileAMask);
+}
+
+#if defined(HAVE_AVX2_FILL)
+// Lanes are north, east, north east and north west shifting up, then south, west, south west and
+// south east shifting down by the same amounts. Each lane's wrap mask clears squares that would
+// have wrapped around the board onto the opposite file.
+__attribute__((target("avx2")))
+static BitBoard
+avx2Fill(BitBoard rookish, BitBoard bishopish, BitBoard occupancy)
+{
+  __m256i down, empty, genDown, genUp, proDown, proUp, ret, shift;
+  __m256i up = _mm256_set_epi64x(NotFileHMask, NotFileAMask, NotFileAMask, FullyOccupied);
+  __m128i folded;
+
+  down = _mm256_set_epi64x(NotFileAMask, NotFileHMask, NotFileHMask, FullyOccupied);
+  shift = _mm256_set_epi64x(7, 9, 1, 8);
+  empty = _mm256_set1_epi64x(~occupancy);
+
+  genUp = _mm256_set_epi64x(bishopish, bishopish, rookish, rookish);
+  genDown = genUp;
+  proUp = _mm256_and_si256(empty, up);
+  proDown = _mm256_and_si256(empty, down);
+
+  genUp = _mm256_or_si256(genUp, _mm256_and_si256(proUp, _mm256_sllv_epi64(genUp, shift)));
+  genDown = _mm256_or_si256(genDown, _mm256_and_si256(proDown, _mm256_srlv_epi64(genDown, shift)));
+  proUp = _mm256_and_si256(proUp, _mm256_sllv_epi64(proUp, shift));
+  proDown = _mm256_and_si256(proDown, _mm256_srlv_epi64(proDown, shift));
+  shift = _mm256_add_epi64(shift, shift);
+
+  genUp = _mm256_or_si256(genUp, _mm256_and_si256(proUp, _mm256_sllv_epi64(genUp, shift)));
+  genDown = _mm256_or_si256(genDown, _mm256_and_si256(proDown, _mm256_srlv_epi64(genDown, shift)));
+  proUp = _mm256_and_si256(proUp, _mm256_sllv_epi64(proUp, shift));
+  proDown = _mm256_and_si256(proDown, _mm256_srlv_epi64(proDown, shift));
+  shift = _mm256_add_epi64(shift, shift);
+
+  genUp = _mm256_or_si256(genUp, _mm256_and_si256(proUp, _mm256_sllv_epi64(genUp, shift)));
+  genDown = _mm256_or_si256(genDown, _mm256_and_si256(proDown, _mm256_srlv_epi64(genDown, shift)));
+
+  // The fills include the sliders themselves and stop short of blockers, so take one more step.
+  shift = _mm256_set_epi64x(7, 9, 1, 8);
+  ret = _mm256_or_si256(_mm256_and_si256(_mm256_sllv_epi64(genUp, shift), up),
+                        _mm256_and_si256(_mm256_srlv_epi64(genDown, shift), down));
+
+  folded = _mm_or_si128(_mm256_castsi256_si128(ret), _mm256_extracti128_si256(ret, 1));
+
+  return (BitBoard)(_mm_cvtsi128_si64(folded) | _mm_extract_epi64(folded, 1));
+}
+#endif
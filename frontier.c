@@ -0,0 +1,166 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "weak.h"
+
+// Initial number of entries, grown by doubling as needed.
+#define INIT_FRONTIER_CAP 1024
+
+static void     addFrontier(Frontier*, Game*, Move*);
+static void     collect(Frontier*, Game*, int, Move*);
+static uint64_t findSlot(Frontier*, uint64_t);
+static void     growFrontier(Frontier*);
+
+// Collect the distinct positions depth plies from the current one, identified by hash, along with
+// how many move sequences reach each. Perft is a property of the position alone, so the perft of
+// the current position to any greater depth is the sum over the frontier of each entry's perft to
+// the remaining depth, weighted by its multiplicity. Release with ReleaseFrontier().
+Frontier
+CollectFrontier(Game *game, int depth)
+{
+  Frontier ret;
+  Move path[MAX_FRONTIER_DEPTH];
+
+  if(depth < 0 || depth > MAX_FRONTIER_DEPTH) {
+    panic("Invalid frontier depth %d.", depth);
+  }
+
+  ret.Depth = depth;
+  ret.Count = 0;
+  ret.Positions = 0;
+  ret.cap = INIT_FRONTIER_CAP;
+  ret.Entries = (FrontierEntry*)allocate(sizeof(FrontierEntry), ret.cap);
+  // Keep the index at most half full, so probe sequences stay short.
+  ret.mask = 2*ret.cap - 1;
+  ret.slots = (int*)allocate(sizeof(int), 2*ret.cap);
+  memset(ret.slots, -1, sizeof(int)*2*ret.cap);
+
+  collect(&ret, game, depth, path);
+
+  return ret;
+}
+
+// Play the moves leading to a frontier entry. Undo with depth calls to Unmove().
+void
+PlayFrontierEntry(Game *game, Frontier *frontier, int index)
+{
+  int i;
+
+  for(i = 0; i < frontier->Depth; i++) {
+    DoMove(game, frontier->Entries[index].Moves[i]);
+  }
+}
+
+void
+ReleaseFrontier(Frontier *frontier)
+{
+  release(frontier->Entries);
+  release(frontier->slots);
+}
+
+static void
+addFrontier(Frontier *frontier, Game *game, Move *path)
+{
+  FrontierEntry *entry;
+  int index;
+  uint64_t slot = findSlot(frontier, game->Hash);
+
+  frontier->Positions++;
+
+  if(frontier->slots[slot] >= 0) {
+    frontier->Entries[frontier->slots[slot]].Multiplicity++;
+    return;
+  }
+
+  if(frontier->Count == frontier->cap) {
+    growFrontier(frontier);
+    // Slots have moved.
+    slot = findSlot(frontier, game->Hash);
+  }
+
+  index = frontier->Count++;
+  entry = &frontier->Entries[index];
+  entry->Hash = game->Hash;
+  entry->Multiplicity = 1;
+  memcpy(entry->Moves, path, sizeof(Move)*frontier->Depth);
+
+  frontier->slots[slot] = index;
+}
+
+static void
+collect(Frontier *frontier, Game *game, int depth, Move *path)
+{
+  Move *curr, *end;
+  Move buffer[INIT_MOVE_LEN];
+  int ply = frontier->Depth - depth;
+
+  if(depth == 0) {
+    addFrontier(frontier, game, path);
+    return;
+  }
+
+  end = AllMoves(buffer, game);
+
+  for(curr = buffer; curr < end; curr++) {
+    path[ply] = *curr;
+
+    DoMove(game, *curr);
+    collect(frontier, game, depth - 1, path);
+    Unmove(game);
+  }
+}
+
+// Find the index slot holding the entry with the specified hash, or the empty slot where it
+// belongs if there is none.
+static uint64_t
+findSlot(Frontier *frontier, uint64_t hash)
+{
+  uint64_t slot = hash&frontier->mask;
+
+  while(frontier->slots[slot] >= 0 && frontier->Entries[frontier->slots[slot]].Hash != hash) {
+    slot = (slot + 1)&frontier->mask;
+  }
+
+  return slot;
+}
+
+// Double the entry capacity and rebuild the index.
+static void
+growFrontier(Frontier *frontier)
+{
+  FrontierEntry *entries = (FrontierEntry*)allocate(sizeof(FrontierEntry), 2*frontier->cap);
+  int i;
+
+  memcpy(entries, frontier->Entries, sizeof(FrontierEntry)*frontier->Count);
+  release(frontier->Entries);
+  frontier->Entries = entries;
+  frontier->cap *= 2;
+
+  release(frontier->slots);
+  frontier->mask = 2*frontier->cap - 1;
+  frontier->slots = (int*)allocate(sizeof(int), 2*frontier->cap);
+  memset(frontier->slots, -1, sizeof(int)*2*frontier->cap);
+
+  for(i = 0; i < frontier->Count; i++) {
+    frontier->slots[findSlot(frontier, entries[i].Hash)] = i;
+  }
+}
@@ -23,6 +23,7 @@
 #include "weak.h"
 #include "magic.h"
 
+static void              calculateCheckStatsField(Game*, CheckStats*, CheckStatsField);
 static void              initArrays(void);
 static FORCE_INLINE void toggleTurn(Game *game);
 static CastleEvent       updateCastlingRights(Game*, Piece, Move, bool);
@@ -33,40 +34,32 @@ static FORCE_INLINE void doCastleQueenSide(Game*);
 static char*             checkConsistency(Game*, BitBoard, BitBoard);
 #endif
 
+// Calculate all CheckStats bar threats, which are only needed for king moves and castling.
 CheckStats
 CalculateCheckStats(Game *game)
 {
-  BitBoard kingBoard, ourKingBoard;
-  BitBoard occupancy = game->ChessSet.Occupancy;
   CheckStats ret;
-  Position king, ourKing;
+  CheckStatsField field;
   Side side = game->WhosTurn;
-  Side opposite = OPPOSITE(side);
-
-  kingBoard = game->ChessSet.Sets[opposite].Boards[King];
-  king = BitScanForward(kingBoard);
-
-  ourKingBoard = game->ChessSet.Sets[side].Boards[King];
-  ourKing = BitScanForward(ourKingBoard);
 
-  ret.AttackedKing = king;
-  ret.DefendedKing = ourKing;
+  ret.AttackedKing = BitScanForward(game->ChessSet.Sets[OPPOSITE(side)].Boards[King]);
+  ret.DefendedKing = BitScanForward(game->ChessSet.Sets[side].Boards[King]);
+  ret.Stale = ALL_STALE_FIELDS;
 
-  // Pieces *we* pin are potential discovered checks.
-  ret.Discovered = PinnedPieces(&game->ChessSet, side, king,    false);
-  ret.Pinned     = PinnedPieces(&game->ChessSet, side, ourKing, true);
-
-  // Attacks *from* king are equivalent to positions attacking *to* the king.
-  ret.CheckSquares[Pawn] = PawnAttacksFrom(king, opposite);
-  ret.CheckSquares[Knight] = KnightAttacksFrom(king);
-  ret.CheckSquares[Bishop] = BishopAttacksFrom(king, occupancy);
-  ret.CheckSquares[Rook] = RookAttacksFrom(king, occupancy);
-  ret.CheckSquares[Queen] = ret.CheckSquares[Rook] | ret.CheckSquares[Bishop];
-  ret.CheckSquares[King] = EmptyBoard;
+  for(field = CheckSquaresField; field <= PinnedField; field++) {
+    calculateCheckStatsField(game, &ret, field);
+  }
 
   return ret;
 }
 
+// Calculate a stale CheckStats field of the game's current position.
+void
+CalculateCheckStatsField(Game *game, CheckStatsField field)
+{
+  calculateCheckStatsField(game, &game->CheckStats, field);
+}
+
 bool
 Checked(Game *game)
 {
@@ -89,9 +82,8 @@ DoMove(Game *game, Move move)
   char *msg;
 #endif
 
-  BitBoard checks, mask;
+  BitBoard checks, checkSquares = EmptyBoard, discovered = EmptyBoard, mask;
   bool givesCheck;
-  CheckStats checkStats = game->CheckStats;
   ChessSet *chessSet = &game->ChessSet;
   int indexCaptured, indexLast, indexTo;
   Memory memory;
@@ -99,7 +91,6 @@ DoMove(Game *game, Move move)
   Piece capturePiece = MissingPiece;
   Position enPassantedPawn, king, last;
   Position from = FROM(move), to = TO(move);
-  Piece originalPiece;
   Piece piece = PieceAt(chessSet, from);
   Piece placePiece = piece; // Default to piece unless we know better.
   Rank offset;
@@ -113,9 +104,20 @@ DoMove(Game *game, Move move)
 
   // Default to no capture.
   memory.Captured = MissingPiece;
+  memory.Hash = game->Hash;
+  memory.HalfMoveClock = game->HalfMoveClock;
 
   givesCheck = GivesCheck(game, move);
 
+  // CheckStats are calculated lazily from the current position, so obtain those we need to
+  // determine check sources before we change it.
+  if(givesCheck) {
+    PROFILE_COUNT(DoMoveChecks);
+
+    checkSquares = CheckSquares(game, piece);
+    discovered = Discovered(game);
+  }
+
   // If we did just have an en passant square and are about to invalidate it,
   // then update the hash accordingly.
   if(game->EnPassantSquare != EmptyPosition) {
@@ -129,24 +131,33 @@ DoMove(Game *game, Move move)
   game->EnPassantSquare = EmptyPosition;
 
   if(type == CastleKingSide) {
+    PROFILE_COUNT(DoMovePaths[CastleKingSidePath]);
+
     doCastleKingSide(game);
   } else if(type == CastleQueenSide) {
+    PROFILE_COUNT(DoMovePaths[CastleQueenSidePath]);
+
     doCastleQueenSide(game);
   } else if(type == EnPassant) {
+    PROFILE_COUNT(DoMovePaths[EnPassantPath]);
+
     offset = -1 + 2*side;
 
     enPassantedPawn = POSITION(RANK(to)+offset, FILE(to));
 
     RemovePiece(chessSet, opposite, Pawn, enPassantedPawn);
     game->Hash ^= ZobristPositionHash[opposite][Pawn][enPassantedPawn];
+    game->Score -= PieceSquareScores[opposite][Pawn][enPassantedPawn];
 
     memory.Captured = Pawn;
 
     RemovePiece(chessSet, side, Pawn, from);
     game->Hash ^= ZobristPositionHash[side][Pawn][from];
+    game->Score -= PieceSquareScores[side][Pawn][from];
 
     PlacePiece (chessSet, side, Pawn, to);
     game->Hash ^= ZobristPositionHash[side][Pawn][to];
+    game->Score += PieceSquareScores[side][Pawn][to];
 
     // TODO: Make quicker.
     UpdateOccupancies(chessSet);
@@ -175,6 +186,7 @@ DoMove(Game *game, Move move)
 
       RemovePiece(chessSet, opposite, capturePiece, to);
       game->Hash ^= ZobristPositionHash[opposite][capturePiece][to];
+      game->Score -= PieceSquareScores[opposite][capturePiece][to];
 
       // Update occupancies.
       mask = POSBOARD(to);
@@ -209,6 +221,9 @@ DoMove(Game *game, Move move)
     chessSet->PiecePositions[side][piece][indexTo] = to;
 
     if(type&PromoteMask) {
+      PROFILE_COUNT(DoMovePaths[capturePiece != MissingPiece ? CapturePromotionPath :
+                                PromotionPath]);
+
       placePiece = type - PromoteMask;
 
       // Delete from pawn list by swapping with last and decrementing count (as with capture).
@@ -231,15 +246,21 @@ DoMove(Game *game, Move move)
       // Update en passant square.
       if(piece == Pawn && RANK(from) == Rank2 + (side*5) &&
          RANK(to) == Rank4 + (side*1)) {
+        PROFILE_COUNT(DoMovePaths[DoublePushPath]);
+
         game->EnPassantSquare = from + (side == White ? 8 : -8);
         game->Hash ^= ZobristEnPassantFileHash[FILE(game->EnPassantSquare)];
+      } else {
+        PROFILE_COUNT(DoMovePaths[capturePiece != MissingPiece ? CapturePath : QuietPath]);
       }
     }
 
     game->Hash ^= ZobristPositionHash[side][piece][from];
+    game->Score -= PieceSquareScores[side][piece][from];
     RemovePiece(chessSet, side, piece, from);
 
     game->Hash ^= ZobristPositionHash[side][placePiece][to];
+    game->Score += PieceSquareScores[side][placePiece][to];
     PlacePiece(chessSet, side, placePiece, to);
 
     // Update occupancies.
@@ -261,6 +282,13 @@ DoMove(Game *game, Move move)
 
   AppendMemory(&game->Memories, memory);
 
+  if(piece == Pawn || memory.Captured != MissingPiece) {
+    game->HalfMoveClock = 0;
+  } else {
+    game->HalfMoveClock++;
+  }
+  game->FullMoveNumber += side;
+
   checks = EmptyBoard;
   if(givesCheck) {
     king = game->CheckStats.AttackedKing;
@@ -270,17 +298,11 @@ DoMove(Game *game, Move move)
       checks = AllAttackersTo(chessSet, king, game->ChessSet.Occupancy) &
         chessSet->Sets[side].Occupancy;
     } else {
-      originalPiece = piece;
-      piece = placePiece;
-
-      if((checkStats.CheckSquares[piece]&POSBOARD(to))) {
+      if(checkSquares&POSBOARD(to)) {
         checks |= POSBOARD(to);
       }
 
-      piece = originalPiece;
-
-      if(checkStats.Discovered &&
-         (checkStats.Discovered&POSBOARD(from))) {
+      if(discovered && (discovered&POSBOARD(from))) {
         if(piece != Rook) {
           checks |= RookAttacksFrom(king, chessSet->Occupancy) &
             (chessSet->Sets[side].Boards[Rook] |
@@ -314,14 +336,27 @@ DoMove(Game *game, Move move)
 
   toggleTurn(game);
 
-  game->CheckStats = CalculateCheckStats(game);
+  // Everything else is calculated on demand.
+  game->CheckStats.AttackedKing = BitScanForward(chessSet->Sets[side].Boards[King]);
+  game->CheckStats.DefendedKing = BitScanForward(chessSet->Sets[opposite].Boards[King]);
   game->CheckStats.CheckSources = checks;
+  game->CheckStats.Stale = ALL_STALE_FIELDS;
+
+  PROFILE_COUNT(CheckStatsPositions);
+}
+
+// Determine whether the game is drawn by the fifty move rule, i.e. 100 plies have passed without a
+// capture or pawn move. Checkmate on the last move takes precedence.
+bool
+FiftyMoveDraw(Game *game)
+{
+  return game->HalfMoveClock >= 100 && !Checkmated(game);
 }
 
 bool
 GivesCheck(Game *game, Move move)
 {
-  BitBoard bishopish, kingBoard, occNoFrom, rookish;
+  BitBoard bishopish, discovered, kingBoard, occNoFrom, rookish;
   BitBoard fromBoard = POSBOARD(FROM(move));
   BitBoard toBoard = POSBOARD(TO(move));
   int offset;
@@ -337,12 +372,13 @@ GivesCheck(Game *game, Move move)
   }
 
   // Direct check.
-  if(game->CheckStats.CheckSquares[piece]&toBoard) {
+  if(CheckSquares(game, piece)&toBoard) {
     return true;
   }
 
   // Discovered checks.
-  if(game->CheckStats.Discovered && (game->CheckStats.Discovered&fromBoard)) {
+  discovered = Discovered(game);
+  if(discovered && (discovered&fromBoard)) {
     switch(piece) {
     case Pawn:
     case King:
@@ -437,10 +473,14 @@ InitEngine()
 {
   InitTrans();
   InitZobrist();
+  InitEval();
   InitKing();
   InitKnight();
+  InitParser();
   InitPawn();
   InitRays();
+  InitCountMovesBatch(true);
+  InitSlidingAttacks(true);
 
   // Relies on above.
   InitMagics();
@@ -515,6 +555,20 @@ NewCheckStats()
   }
   ret.Discovered = EmptyBoard;
   ret.Pinned = EmptyBoard;
+  ret.Threats = EmptyBoard;
+  ret.Stale = ALL_STALE_FIELDS;
+
+  return ret;
+}
+
+// Copy a game, including its own copy of the move history, so the copy can be played
+// independently of the original, e.g. on another thread. Release with ReleaseGame().
+Game
+CopyGame(Game *game)
+{
+  Game ret = *game;
+
+  ret.Memories = CopyMemorySlice(&game->Memories);
 
   return ret;
 }
@@ -541,6 +595,7 @@ NewEmptyGame(bool debug, Side humanSide)
   ret.ChessSet = NewEmptyChessSet();
 
   ret.Hash = HashGame(&ret);
+  ret.Score = ScoreGame(&ret);
 
   return ret;
 }
@@ -569,15 +624,48 @@ NewGame(bool debug, Side humanSide)
 
   ret.Debug = debug;
   ret.EnPassantSquare = EmptyPosition;
+  ret.HalfMoveClock = 0;
+  ret.FullMoveNumber = 1;
   ret.Memories = NewMemorySlice();
   ret.HumanSide = humanSide;
   ret.WhosTurn = White;
 
   ret.Hash = HashGame(&ret);
+  ret.Score = ScoreGame(&ret);
 
   return ret;
 }
 
+// Release resources held by a game returned by CopyGame().
+void
+ReleaseGame(Game *game)
+{
+  ReleaseMemorySlice(&game->Memories);
+}
+
+// Determine whether the current position has occurred before in the game. Positions before the
+// last capture or pawn move can't recur, nor can those with the other side to move, so we step
+// back 2 plies at a time through at most HalfMoveClock plies of history.
+bool
+Repeated(Game *game)
+{
+  long i, count = game->Memories.Curr - game->Memories.Vals;
+  long start = count - game->HalfMoveClock;
+
+  if(start < 0) {
+    start = 0;
+  }
+
+  // The position 2 plies ago can't be the same, as both sides would have passed.
+  for(i = count - 4; i >= start; i -= 2) {
+    if(game->Memories.Vals[i].Hash == game->Hash) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 // Determine whether the game is in a state of stalemate, i.e. the current player cannot make a
 // move.
 bool
@@ -590,7 +678,7 @@ Stalemated(Game *game)
 bool
 PseudoLegal(Game *game, Move move, BitBoard pinned)
 {
-  BitBoard bitBoard, opposition;
+  BitBoard bitBoard;
   Piece piece = PieceAt(&game->ChessSet, FROM(move));
   Position king;
   Side opposite;
@@ -617,12 +705,7 @@ PseudoLegal(Game *game, Move move, BitBoard pinned)
       return true;
     }
 
-    opposite = OPPOSITE(game->WhosTurn);
-    opposition = game->ChessSet.Sets[opposite].Occupancy;
-
-    return
-      !(AllAttackersTo(&game->ChessSet, TO(move),
-                      game->ChessSet.Occupancy)&opposition);
+    return !(Threats(game)&POSBOARD(TO(move)));
   }
 
   // A non-king move is legal if its not pinned or is moving in the ray between it and the king.
@@ -659,28 +742,30 @@ Unmove(Game *game)
   memory = PopMemory(&game->Memories);
   move = memory.Move;
   capturePiece = memory.Captured;
+  game->HalfMoveClock = memory.HalfMoveClock;
 
   // Rollback to previous turn.
   from = FROM(move);
   to = TO(move);
   toggleTurn(game);
   side = game->WhosTurn;
+  game->FullMoveNumber -= side;
 
   piece = PieceAt(chessSet, to);
 
   switch(TYPE(move)) {
   case EnPassant:
     RemovePiece(chessSet, side, Pawn, to);
-    game->Hash ^= ZobristPositionHash[side][Pawn][to];
+    game->Score -= PieceSquareScores[side][Pawn][to];
 
     PlacePiece(chessSet, side, Pawn, from);
-    game->Hash ^= ZobristPositionHash[side][Pawn][from];
+    game->Score += PieceSquareScores[side][Pawn][from];
 
     offset = -1 + side*2;
     enPassantedPawn = POSITION(RANK(to)+offset, FILE(to));
 
     PlacePiece(chessSet, opposite, Pawn, enPassantedPawn);
-    game->Hash ^= ZobristPositionHash[opposite][Pawn][enPassantedPawn];
+    game->Score += PieceSquareScores[opposite][Pawn][enPassantedPawn];
 
     indexLast = chessSet->PieceCounts[opposite][Pawn]++;
     chessSet->PiecePositionIndexes[enPassantedPawn] = indexLast;
@@ -721,10 +806,10 @@ Unmove(Game *game)
     }
 
     RemovePiece(chessSet, side, removePiece, to);
-    game->Hash ^= ZobristPositionHash[side][removePiece][to];
+    game->Score -= PieceSquareScores[side][removePiece][to];
 
     PlacePiece(chessSet, side, piece, from);
-    game->Hash ^= ZobristPositionHash[side][piece][from];
+    game->Score += PieceSquareScores[side][piece][from];
 
     indexTo = chessSet->PiecePositionIndexes[to];
     chessSet->PiecePositionIndexes[from] = indexTo;
@@ -744,7 +829,7 @@ Unmove(Game *game)
 
     if(capturePiece != MissingPiece) {
       PlacePiece(chessSet, opposite, capturePiece, to);
-      game->Hash ^= ZobristPositionHash[opposite][capturePiece][to];
+      game->Score += PieceSquareScores[opposite][capturePiece][to];
 
       // Update occupancies.
       mask = POSBOARD(to);
@@ -765,16 +850,16 @@ Unmove(Game *game)
     offset = side == White ? 0 : 8*7;
 
     RemovePiece(chessSet, side, King, C1+offset);
-    game->Hash ^= ZobristPositionHash[side][King][C1+offset];
+    game->Score -= PieceSquareScores[side][King][C1+offset];
 
     PlacePiece(chessSet, side, King, E1+offset);
-    game->Hash ^= ZobristPositionHash[side][King][E1+offset];
+    game->Score += PieceSquareScores[side][King][E1+offset];
 
     RemovePiece(chessSet, side, Rook, D1+offset);
-    game->Hash ^= ZobristPositionHash[side][Rook][D1+offset];
+    game->Score -= PieceSquareScores[side][Rook][D1+offset];
 
     PlacePiece(chessSet, side, Rook, A1+offset);
-    game->Hash ^= ZobristPositionHash[side][Rook][A1+offset];
+    game->Score += PieceSquareScores[side][Rook][A1+offset];
 
     indexTo = chessSet->PiecePositionIndexes[C1 + offset];
 
@@ -794,16 +879,16 @@ Unmove(Game *game)
     offset = game->WhosTurn == White ? 0 : 8*7;
 
     RemovePiece(chessSet, side, King, G1+offset);
-    game->Hash ^= ZobristPositionHash[side][King][G1+offset];
+    game->Score -= PieceSquareScores[side][King][G1+offset];
 
     PlacePiece(chessSet, side, King, E1+offset);
-    game->Hash ^= ZobristPositionHash[side][King][E1+offset];
+    game->Score += PieceSquareScores[side][King][E1+offset];
 
     RemovePiece(chessSet, side, Rook, F1+offset);
-    game->Hash ^= ZobristPositionHash[side][Rook][F1+offset];
+    game->Score -= PieceSquareScores[side][Rook][F1+offset];
 
     PlacePiece(chessSet, side, Rook, H1+offset);
-    game->Hash ^= ZobristPositionHash[side][Rook][H1+offset];
+    game->Score += PieceSquareScores[side][Rook][H1+offset];
 
     indexTo = chessSet->PiecePositionIndexes[G1 + offset];
 
@@ -825,34 +910,25 @@ Unmove(Game *game)
 
   game->CheckStats = memory.CheckStats;
 
-  if(game->EnPassantSquare != EmptyPosition) {
-    game->Hash ^= ZobristEnPassantFileHash[FILE(game->EnPassantSquare)];
-  }
+  // Restoring the hash is cheaper than reversing each update to it.
+  game->Hash = memory.Hash;
 
   game->EnPassantSquare = memory.EnPassantSquare;
 
-  if(game->EnPassantSquare != EmptyPosition) {
-    game->Hash ^= ZobristEnPassantFileHash[FILE(game->EnPassantSquare)];
-  }
-
   castleEvent = memory.CastleEvent;
 
   if(castleEvent != NoCastleEvent) {
     if(castleEvent&LostKingSideWhite) {
       game->CastlingRights[White][KingSide] = true;
-      game->Hash ^= ZobristCastlingHash[White][KingSide];
     }
     if(castleEvent&LostQueenSideWhite) {
       game->CastlingRights[White][QueenSide] = true;
-      game->Hash ^= ZobristCastlingHash[White][QueenSide];
     }
     if(castleEvent&LostKingSideBlack) {
       game->CastlingRights[Black][KingSide] = true;
-      game->Hash ^= ZobristCastlingHash[Black][KingSide];
     }
     if(castleEvent&LostQueenSideBlack) {
       game->CastlingRights[Black][QueenSide] = true;
-      game->Hash ^= ZobristCastlingHash[Black][QueenSide];
     }
   }
 
@@ -879,15 +955,19 @@ doCastleKingSide(Game *game)
 
   RemovePiece(chessSet, side, King, E1 + offset);
   game->Hash ^= ZobristPositionHash[side][King][E1+offset];
+  game->Score -= PieceSquareScores[side][King][E1+offset];
 
   PlacePiece(chessSet, side, King, G1 + offset);
   game->Hash ^= ZobristPositionHash[side][King][G1+offset];
+  game->Score += PieceSquareScores[side][King][G1+offset];
 
   RemovePiece(chessSet, side, Rook, H1 + offset);
   game->Hash ^= ZobristPositionHash[side][Rook][H1+offset];
+  game->Score -= PieceSquareScores[side][Rook][H1+offset];
 
   PlacePiece(chessSet, side, Rook, F1 + offset);
   game->Hash ^= ZobristPositionHash[side][Rook][F1+offset];
+  game->Score += PieceSquareScores[side][Rook][F1+offset];
 
   index = chessSet->PiecePositionIndexes[E1 + offset];
 
@@ -912,15 +992,19 @@ doCastleQueenSide(Game *game)
 
   RemovePiece(chessSet, side, King, E1 + offset);
   game->Hash ^= ZobristPositionHash[side][King][E1+offset];
+  game->Score -= PieceSquareScores[side][King][E1+offset];
 
   PlacePiece(chessSet, side, King, C1 + offset);
   game->Hash ^= ZobristPositionHash[side][King][C1+offset];
+  game->Score += PieceSquareScores[side][King][C1+offset];
 
   RemovePiece(chessSet, side, Rook, A1 + offset);
   game->Hash ^= ZobristPositionHash[side][Rook][A1+offset];
+  game->Score -= PieceSquareScores[side][Rook][A1+offset];
 
   PlacePiece(chessSet, side, Rook, D1 + offset);
   game->Hash ^= ZobristPositionHash[side][Rook][D1+offset];
+  game->Score += PieceSquareScores[side][Rook][D1+offset];
 
   index = chessSet->PiecePositionIndexes[E1 + offset];
 
@@ -935,6 +1019,50 @@ doCastleQueenSide(Game *game)
   UpdateOccupancies(&game->ChessSet);
 }
 
+static void
+calculateCheckStatsField(Game *game, CheckStats *checkStats, CheckStatsField field)
+{
+  ChessSet *chessSet = &game->ChessSet;
+  BitBoard occupancy = chessSet->Occupancy;
+  Position king = checkStats->AttackedKing;
+  Side side = game->WhosTurn;
+  Side opposite = OPPOSITE(side);
+
+  PROFILE_COUNT(CheckStatsCalculated[field]);
+
+  switch(field) {
+  case CheckSquaresField:
+    // Attacks *from* king are equivalent to positions attacking *to* the king.
+    checkStats->CheckSquares[Pawn] = PawnAttacksFrom(king, opposite);
+    checkStats->CheckSquares[Knight] = KnightAttacksFrom(king);
+    checkStats->CheckSquares[Bishop] = BishopAttacksFrom(king, occupancy);
+    checkStats->CheckSquares[Rook] = RookAttacksFrom(king, occupancy);
+    checkStats->CheckSquares[Queen] = checkStats->CheckSquares[Rook] |
+      checkStats->CheckSquares[Bishop];
+    checkStats->CheckSquares[King] = EmptyBoard;
+
+    break;
+  case DiscoveredField:
+    // Pieces *we* pin are potential discovered checks.
+    checkStats->Discovered = PinnedPieces(chessSet, side, king, false);
+
+    break;
+  case PinnedField:
+    checkStats->Pinned = PinnedPieces(chessSet, side, checkStats->DefendedKing, true);
+
+    break;
+  case ThreatsField:
+    checkStats->Threats = AllAttacksFrom(chessSet, opposite,
+                                         occupancy ^ POSBOARD(checkStats->DefendedKing));
+
+    break;
+  default:
+    panic("Invalid CheckStats field %d.", field);
+  }
+
+  checkStats->Stale &= ~STALE_FIELD(field);
+}
+
 static void
 initArrays()
 {
@@ -1271,7 +1399,14 @@ checkConsistency(Game *game, BitBoard checks, BitBoard modelChecks)
                  HashGame(game), game->Hash);
   }
 
+  // Check incrementally updated score.
+  if(game->Score != ScoreGame(game)) {
+    AppendString(&builder, "Incorrect score - calculated %d, game->Score is %d.\n",
+                 ScoreGame(game), game->Score);
+  }
+
   if(builder.Length == 0) {
+    ReleaseStringBuilder(&builder);
     return NULL;
   }
 
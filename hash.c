@@ -61,6 +61,62 @@ HashGame(Game *game)
   return ret;
 }
 
+// Determine the hash of the position resulting from the specified move without making it. We
+// don't account for castling rights lost by the move, so this is only suitable as a hint, e.g. for
+// prefetching.
+uint64_t
+HashAfter(Game *game, Move move)
+{
+  ChessSet *chessSet = &game->ChessSet;
+  int offset;
+  MoveType type = TYPE(move);
+  Piece captured, piece, placePiece;
+  Position from = FROM(move), to = TO(move);
+  Side side = game->WhosTurn;
+  Side opposite = OPPOSITE(side);
+  uint64_t ret = game->Hash ^ ZobristBlackHash;
+
+  if(game->EnPassantSquare != EmptyPosition) {
+    ret ^= ZobristEnPassantFileHash[FILE(game->EnPassantSquare)];
+  }
+
+  switch(type) {
+  case CastleKingSide:
+    offset = side*8*7;
+
+    return ret ^
+      ZobristPositionHash[side][King][E1+offset] ^ ZobristPositionHash[side][King][G1+offset] ^
+      ZobristPositionHash[side][Rook][H1+offset] ^ ZobristPositionHash[side][Rook][F1+offset];
+  case CastleQueenSide:
+    offset = side*8*7;
+
+    return ret ^
+      ZobristPositionHash[side][King][E1+offset] ^ ZobristPositionHash[side][King][C1+offset] ^
+      ZobristPositionHash[side][Rook][A1+offset] ^ ZobristPositionHash[side][Rook][D1+offset];
+  case EnPassant:
+    ret ^= ZobristPositionHash[opposite][Pawn][POSITION(RANK(from), FILE(to))];
+    break;
+  default:
+    captured = PieceAt(chessSet, to);
+    if(captured != MissingPiece) {
+      ret ^= ZobristPositionHash[opposite][captured][to];
+    }
+    break;
+  }
+
+  piece = PieceAt(chessSet, from);
+  placePiece = type&PromoteMask ? type - PromoteMask : piece;
+
+  ret ^= ZobristPositionHash[side][piece][from] ^ ZobristPositionHash[side][placePiece][to];
+
+  // Double pawn push.
+  if(piece == Pawn && RankDistance(from, to) == 2) {
+    ret ^= ZobristEnPassantFileHash[FILE(to)];
+  }
+
+  return ret;
+}
+
 void
 InitZobrist()
 {
@@ -22,14 +22,25 @@
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include "weak.h"
 
+// Plies below the root at which distributed and unique perft split the tree, unless --split is
+// given.
+#define DEFAULT_SPLIT_DEPTH 3
+
 int
 main(int argc, char **argv)
 {
+  bool divide = false, profile = false, unique = false, worker = false;
+  char *checkpoint = NULL, *program = argv[0], *workerCommand = NULL;
+  char total[UINT128_DECIMAL_LEN];
+  FrontierStats frontier;
   Game game;
-  uint64_t perftVal;
-  int depth;
+  ResumeStats resume;
+  uint64_t perftVal = 0;
+  Uint128 perftTotal;
+  int depth, hashMb = 0, split = DEFAULT_SPLIT_DEPTH, threads = 0, workers = 0;
 
   SetUnbufferedOutput();
 
@@ -38,8 +49,102 @@ main(int argc, char **argv)
       return EXIT_SUCCESS;
   }
 
+  for(;;) {
+    if(argc >= 3 && strcmp(argv[1], "--hash") == 0) {
+      if((hashMb = atoi(argv[2])) < 1) {
+        fprintf(stderr, "Invalid hash size '%s'.\n", argv[2]);
+        return EXIT_FAILURE;
+      }
+
+      argc -= 2;
+      argv += 2;
+    } else if(argc >= 3 && strcmp(argv[1], "--checkpoint") == 0) {
+      checkpoint = argv[2];
+
+      argc -= 2;
+      argv += 2;
+    } else if(argc >= 3 && strcmp(argv[1], "--threads") == 0) {
+      if((threads = atoi(argv[2])) < 1) {
+        fprintf(stderr, "Invalid thread count '%s'.\n", argv[2]);
+        return EXIT_FAILURE;
+      }
+
+      argc -= 2;
+      argv += 2;
+    } else if(argc >= 3 && strcmp(argv[1], "--workers") == 0) {
+      if((workers = atoi(argv[2])) < 1) {
+        fprintf(stderr, "Invalid worker count '%s'.\n", argv[2]);
+        return EXIT_FAILURE;
+      }
+
+      argc -= 2;
+      argv += 2;
+    } else if(argc >= 3 && strcmp(argv[1], "--worker-command") == 0) {
+      workerCommand = argv[2];
+
+      argc -= 2;
+      argv += 2;
+    } else if(argc >= 3 && strcmp(argv[1], "--split") == 0) {
+      if((split = atoi(argv[2])) < 1 || split > MAX_FRONTIER_DEPTH) {
+        fprintf(stderr, "Invalid split depth '%s'.\n", argv[2]);
+        return EXIT_FAILURE;
+      }
+
+      argc -= 2;
+      argv += 2;
+    } else if(argc >= 2 && strcmp(argv[1], "--worker") == 0) {
+      worker = true;
+
+      argc--;
+      argv++;
+    } else if(argc >= 2 && strcmp(argv[1], "--unique") == 0) {
+      unique = true;
+
+      argc--;
+      argv++;
+    } else if(argc >= 2 && strcmp(argv[1], "--divide") == 0) {
+      divide = true;
+
+      argc--;
+      argv++;
+    } else if(argc >= 2 && strcmp(argv[1], "--profile") == 0) {
+#if !defined(PROFILE)
+      fprintf(stderr, "--profile requires a PROFILE build, e.g. make profile.\n");
+      return EXIT_FAILURE;
+#endif
+      profile = true;
+
+      argc--;
+      argv++;
+    } else {
+      break;
+    }
+  }
+
+  // The counters aren't synchronised, and worker processes keep their own.
+  if(profile && (threads > 0 || unique || checkpoint != NULL || workers > 0 || worker)) {
+    fprintf(stderr, "--profile requires a single-threaded local perft, so can't be combined "
+            "with\n--threads, --unique, --checkpoint, --workers or --worker.\n");
+    return EXIT_FAILURE;
+  }
+
+  if(worker) {
+    // Jobs come from a coordinator, see DistributedPerft().
+    if(hashMb > 0) {
+      ResizeTrans(hashMb);
+    }
+    InitEngine();
+    PerftWorker(STDIN_FILENO, STDOUT_FILENO, hashMb > 0);
+
+    return EXIT_SUCCESS;
+  }
+
   if(argc < 3) {
-    fprintf(stderr, "Usage: %s [fen] [depth]\n", argv[0]);
+    fprintf(stderr, "Usage: %s [--hash MB] [--threads N] [--checkpoint file] [--divide] "
+            "[--profile]\n"
+            "       [--unique | --workers N [--worker-command command]] [--split plies] [fen] "
+            "[depth]\n"
+            "       %s [--hash MB] --worker\n", program, program);
     return EXIT_FAILURE;
   }
 
@@ -52,13 +157,66 @@ main(int argc, char **argv)
   randk_seed();
   randk_warmup(KISS_WARMUP_ROUNDS);
 
+  // Size the table before InitEngine() so we don't allocate the default one first.
+  if(hashMb > 0) {
+    ResizeTrans(hashMb);
+  }
+
   InitEngine();
 
   game = ParseFen(argv[1]);
 
-  perftVal = QuickPerft(&game, depth);
+  if(workers > 0) {
+    if(!DistributedPerft(&game, depth, split, workers, workerCommand, hashMb > 0,
+                         &perftTotal, &frontier)) {
+      return EXIT_FAILURE;
+    }
+  } else if(unique) {
+    UniquePerft(&game, depth, split, threads, hashMb > 0, &perftTotal, &frontier);
+  } else if(checkpoint != NULL) {
+    if(!CheckpointPerft(&game, depth, threads, hashMb > 0, checkpoint, &perftTotal, &resume)) {
+      fprintf(stderr, "Unable to use checkpoint '%s' - %s.\n", checkpoint,
+              StringCheckpointError(resume.Error));
+      return EXIT_FAILURE;
+    }
+  } else if(divide) {
+    perftVal = DividePerft(&game, depth, hashMb > 0);
+  } else if(threads > 0) {
+    perftVal = ParallelPerft(&game, depth, threads, hashMb > 0, NULL);
+  } else if(hashMb > 0) {
+    perftVal = HashPerft(&game, depth, true);
+  } else {
+    perftVal = QuickPerft(&game, depth);
+  }
+
+  // Any buffered output has to precede the total.
+  FlushOutput();
+
+  if(workers == 0 && !unique && checkpoint == NULL) {
+    perftTotal.Hi = 0;
+    perftTotal.Lo = perftVal;
+  }
+  FormatUint128(perftTotal, total);
+  printf("%s\n", total);
+
+  if((workers > 0 || unique) && frontier.Count > 0) {
+    fprintf(stderr, "Frontier at depth %d: %lu positions, %d unique.\n", frontier.Depth,
+            frontier.Positions, frontier.Count);
+  }
 
-  printf("%lu\n", perftVal);
+  if(checkpoint != NULL && resume.Resumed > 0) {
+    fprintf(stderr, "Resumed from checkpoint, %d of %d subtrees already counted.\n",
+            resume.Resumed, resume.Subtrees);
+  }
+
+  if(hashMb > 0) {
+    fprintf(stderr, "Hash %d MB, %lu entries, %d permille full.\n", hashMb, TransEntries(),
+            HashFull());
+  }
+
+  if(profile) {
+    PrintProfile();
+  }
 
   return EXIT_SUCCESS;
 }
@@ -44,6 +44,7 @@ static FORCE_INLINE Move* rookMoves(Position*, Move*, BitBoard, BitBoard);
 Move*
 AllCaptures(Move *start, Game *game)
 {
+  BitBoard pinned;
   Move *curr = start, *end = start;
   Move move;
 
@@ -51,10 +52,12 @@ AllCaptures(Move *start, Game *game)
     evasionsCaptures(start, game) :
     nonEvasionsCaptures(start, game);
 
+  pinned = Pinned(game);
+
   // Filter out illegal moves.
   while(curr != end) {
     move = *curr;
-    if(!PseudoLegal(game, move, game->CheckStats.Pinned)) {
+    if(!PseudoLegal(game, move, pinned)) {
       // Switch last move with the one we are rejecting.
       end--;
       *curr = *end;
@@ -69,13 +72,26 @@ AllCaptures(Move *start, Game *game)
 Move*
 AllMoves(Move *start, Game *game)
 {
+  BitBoard pinned;
   Move *curr = start, *end = start;
 
-  end = game->CheckStats.CheckSources ? Evasions(start, game) : nonEvasions(start, game);
+  if(game->CheckStats.CheckSources) {
+    PROFILE_COUNT(EvasionNodes);
+    end = Evasions(start, game);
+  } else {
+    PROFILE_COUNT(NonEvasionNodes);
+    end = nonEvasions(start, game);
+  }
+
+  PROFILE_ADD(PseudoLegalMoves, end - start);
+
+  pinned = Pinned(game);
 
   // Filter out illegal moves.
   while(curr != end) {
-    if(!PseudoLegal(game, *curr, game->CheckStats.Pinned)) {
+    if(!PseudoLegal(game, *curr, pinned)) {
+      PROFILE_COUNT(PseudoLegalRejected);
+
       // Switch last move with the one we are rejecting.
       end--;
       *curr = *end;
@@ -102,12 +118,9 @@ AnyMoves(Game *game)
 Move*
 CastleMoves(Game *game, Move *end)
 {
-  BitBoard attackMask, occupancy, opposition;
-  bool good;
   CastleSide castleSide;
-  Position king, pos;
+  Position king;
   Side side = game->WhosTurn;
-  Side opposite;
 
   king = E1 + side*8*7;
 
@@ -115,28 +128,15 @@ CastleMoves(Game *game, Move *end)
   for(castleSide = KingSide; castleSide <= QueenSide; castleSide++) {
     if(game->CastlingRights[side][castleSide] &&
        !(game->ChessSet.Occupancy&CastlingMasks[side][castleSide])) {
-      occupancy = game->ChessSet.Occupancy;
-      opposite = OPPOSITE(side);
-      opposition = game->ChessSet.Sets[opposite].Occupancy;
-
-      good = true;
       // ...Determine whether we are attacked along the attack mask.
-      attackMask = CastlingAttackMasks[side][castleSide];
-      while(attackMask) {
-        pos = PopForward(&attackMask);
-
-        if((AllAttackersTo(&game->ChessSet, pos, occupancy) & opposition)) {
-          good = false;
-          break;
-        }
+      if(Threats(game)&CastlingAttackMasks[side][castleSide]) {
+        continue;
       }
 
-      if(good) {
-        if(castleSide == QueenSide) {
-          *end++ = MAKE_MOVE(king, king-2, CastleQueenSide);
-        } else {
-          *end++ = MAKE_MOVE(king, king-2, CastleKingSide);
-        }
+      if(castleSide == QueenSide) {
+        *end++ = MAKE_MOVE(king, king-2, CastleQueenSide);
+      } else {
+        *end++ = MAKE_MOVE(king, king-2, CastleKingSide);
       }
     }
   }
@@ -147,14 +147,11 @@ CastleMoves(Game *game, Move *end)
 Move*
 Evasions(Move *end, Game *game)
 {
-  BitBoard attacks, moves, targets;
+  BitBoard moves, targets;
   BitBoard checks = game->CheckStats.CheckSources;
-  BitBoard slideAttacks = EmptyBoard;
   ChessSet *chessSet = &game->ChessSet;
   BitBoard occupancy = chessSet->Occupancy;
-  int checkCount = 0;
-  Piece piece;
-  Position check = EmptyPosition;
+  Position check;
   Position king = game->CheckStats.DefendedKing;
   Side side = game->WhosTurn;
   // We can only 'attack' empty squares and opponents' pieces.
@@ -162,57 +159,22 @@ Evasions(Move *end, Game *game)
 
   assert(checks);
 
-  while(checks) {
-    check = PopForward(&checks);
+  // King evasion moves. Threats are calculated with the king removed from the board, so squares
+  // along the line of a sliding check are correctly excluded.
 
-    checkCount++;
-
-    piece = PieceAt(chessSet, check);
-
-    switch(piece) {
-    case Bishop:
-      slideAttacks |= EmptyAttacks[Bishop][check];
-
-      break;
-    case Rook:
-      slideAttacks |= EmptyAttacks[Rook][check];
-
-      break;
-    case Queen:
-      // If king and queen are far away, i.e. there are squares between them, or they are not
-      // on a diagonal, we can remove all squares in all directions as the king can't get to them.
-      if(Between[king][check] ||
-         !(EmptyAttacks[Bishop][check] & POSBOARD(king))) {
-        slideAttacks |= EmptyAttacks[Queen][check];
-      } else {
-        slideAttacks |= EmptyAttacks[Bishop][check] |
-          RookAttacksFrom(check, occupancy);
-      }
-
-      break;
-    default:
-      break;
-    }
-  }
-
-  attacks = KingAttacksFrom(king) & ~slideAttacks;
-
-  // King evasion moves.
-
-  moves = attacks & attackable;
+  moves = KingAttacksFrom(king) & attackable & ~Threats(game);
   while(moves) {
     *end++ = MAKE_MOVE_QUICK(king, PopForward(&moves));
   }
 
   // If there is more than 1 check, blocking won't achieve anything.
-  if(checkCount > 1) {
+  if(!SingleBit(checks)) {
     return end;
   }
 
   // Blocking/capturing the checking piece.
-  // We use check from the loop above, since we have only 1 check this will
-  // be the sole checker.
-  targets = attackable & (Between[check][king] | game->CheckStats.CheckSources);
+  check = BitScanForward(checks);
+  targets = attackable & (Between[check][king] | checks);
 
   if(side == White) {
     end = pawnMovesWhite(game, end, targets, true);
@@ -234,67 +196,29 @@ evasionsCaptures(Move *end, Game *game)
 {
   BitBoard attacks, targets;
   BitBoard checks = game->CheckStats.CheckSources;
-  BitBoard slideAttacks = EmptyBoard;
   ChessSet *chessSet = &game->ChessSet;
   BitBoard occupancy = chessSet->Occupancy;
-  int checkCount = 0;
-  Piece piece;
   Position check;
   Position king = game->CheckStats.DefendedKing;
   Side side = game->WhosTurn;
   Side opposite = OPPOSITE(side);
   BitBoard opposition = chessSet->Sets[opposite].Occupancy;
 
-  while(checks) {
-    check = PopForward(&checks);
-
-    checkCount++;
-
-    piece = PieceAt(chessSet, check);
-
-    switch(piece) {
-    case Bishop:
-      slideAttacks |= EmptyAttacks[Bishop][check];
-
-      break;
-    case Rook:
-      slideAttacks |= EmptyAttacks[Rook][check];
-
-      break;
-    case Queen:
-      // If king and queen are far away, i.e. there are squares between them, or they are not
-      // on a diagonal, we can remove all squares in all directions as the king can't get to them.
-      if(Between[king][check] ||
-         !(EmptyAttacks[Bishop][check] & POSBOARD(king))) {
-        slideAttacks |= EmptyAttacks[Queen][check];
-      } else {
-        slideAttacks |= EmptyAttacks[Bishop][check] |
-          RookAttacksFrom(check, occupancy);
-      }
-
-      break;
-    default:
-      break;
-    }
-  }
-
-  attacks = KingAttacksFrom(king) & ~slideAttacks & opposition;
-
   // King evasion moves.
 
+  attacks = KingAttacksFrom(king) & opposition & ~Threats(game);
   while(attacks) {
     *end++ = MAKE_MOVE_QUICK(king, PopForward(&attacks));
   }
 
   // If there is more than 1 check, blocking won't achieve anything.
-  if(checkCount > 1) {
+  if(!SingleBit(checks)) {
     return end;
   }
 
-  // Blocking/capturing the checking piece.
-  // We use check from the loop above, since we have only 1 check this will
-  // be the sole checker.
-  targets = opposition & (Between[check][king] | game->CheckStats.CheckSources);
+  // Capturing the checking piece.
+  check = BitScanForward(checks);
+  targets = opposition & (Between[check][king] | checks);
 
   if(side == White) {
     end = pawnMovesWhite(game, end, targets, true);
@@ -24,188 +24,230 @@
 #include <string.h>
 #include "weak.h"
 
-// Parse a FEN string into a game object.
+// Piece and side for each FEN piece placement character, 0 for invalid characters.
+#define FEN_PIECE(side, piece) ((side)<<3 | (piece))
+static const unsigned char fenPieces[128] = {
+  ['P'] = FEN_PIECE(White, Pawn),   ['p'] = FEN_PIECE(Black, Pawn),
+  ['N'] = FEN_PIECE(White, Knight), ['n'] = FEN_PIECE(Black, Knight),
+  ['B'] = FEN_PIECE(White, Bishop), ['b'] = FEN_PIECE(Black, Bishop),
+  ['R'] = FEN_PIECE(White, Rook),   ['r'] = FEN_PIECE(Black, Rook),
+  ['Q'] = FEN_PIECE(White, Queen),  ['q'] = FEN_PIECE(Black, Queen),
+  ['K'] = FEN_PIECE(White, King),   ['k'] = FEN_PIECE(Black, King)
+};
+
+// Copied rather than calling NewEmptyChessSet() for each FEN, which takes as long as parsing.
+static ChessSet emptyChessSet;
+
+static FORCE_INLINE bool isFenSpace(char);
+static bool              parseCastling(Game*, const char**, const char*);
+static bool              parseNumber(const char**, const char*, int*);
+static FORCE_INLINE bool skipSpaces(const char**, const char*);
+
+void
+InitParser()
+{
+  emptyChessSet = NewEmptyChessSet();
+}
+
+// Parse a FEN string into a game object, panicking if it's invalid.
 // See http://en.wikipedia.org/wiki/Forsyth%E2%80%93Edwards_Notation
 Game
 ParseFen(char *fen)
 {
-  bool seenKing[2] = { false, false };
-  char chr;
-  int i, len, pieceCount;
-  // Make file/rank integers so we can make them negative to detect errors. Both are unsigned.
-  // TODO: fix.
-  int file, rank;
+  FenError error;
   Game ret = NewEmptyGame(false, White);
-  Piece piece = MissingPiece;
-  Position king, pos;
-  Side side;
 
   if(fen == NULL) {
     panic("Null char pointer in ParseFen().");
   }
 
-  len = strlen(fen);
-
-  if(len < 25) {
-    panic("Invalid FEN '%s' - too short. Expect at least 25 characters.", fen);
+  if((error = ParseFenInto(&ret, fen, strlen(fen))) != FenOk) {
+    panic("Invalid FEN '%s' - %s.", fen, StringFenError(error));
   }
 
-  rank = Rank8;
-  file = FileA;
-  for(i = 0; i < len; i++) {
-    chr = fen[i];
+  return ret;
+}
+
+// Parse the len characters of fen into game, which must already have been created, e.g. by
+// NewEmptyGame(), and whose move history is cleared and reused. Returns FenOk, or the first
+// problem found, in which case the game's contents are unspecified. Omitted clocks default to 0
+// and 1.
+//
+// Intended for bulk ingestion, so nothing is allocated, and the hash and score are accumulated
+// as pieces are placed rather than recalculated afterwards.
+FenError
+ParseFenInto(Game *game, const char *fen, size_t len)
+{
+  BitBoard checkers, pawns;
+  ChessSet *chessSet = &game->ChessSet;
+  const char *curr = fen, *end = fen + len;
+  int count, file = FileA, rank = Rank8, score = 0;
+  unsigned char chr, code;
+  Piece piece;
+  Position pos;
+  Side side;
+  uint64_t hash = 0;
+
+  *chessSet = emptyChessSet;
+
+  // Piece placement.
+  for(; curr < end && !isFenSpace(*curr); curr++) {
+    chr = (unsigned char)*curr;
 
     if(chr >= '1' && chr <= '8') {
-      file += (chr - '0');
-      continue;
+      file += chr - '0';
+      if(file > FileH + 1) {
+        return FenInvalidPlacement;
+      }
     } else if(chr == '/') {
+      if(file != FileH + 1 || rank == Rank1) {
+        return FenInvalidPlacement;
+      }
       rank--;
       file = FileA;
-      continue;
-    } else if(rank == Rank1 && chr == ' ') {
-      break;
     } else {
-      side = isupper(chr) ? White : Black;
-      switch(chr) {
-      case 'P':
-      case 'p':
-        piece = Pawn;
-        break;
-      case 'R':
-      case 'r':
-        piece = Rook;
-        break;
-      case 'N':
-      case 'n':
-        piece = Knight;
-        break;
-      case 'B':
-      case 'b':
-        piece = Bishop;
-        break;
-      case 'Q':
-      case 'q':
-        piece = Queen;
-        break;
-      case 'K':
-      case 'k':
-        piece = King;
-        seenKing[side] = true;
-        break;
-      default:
-        panic("Unrecognised character '%c' at position %d.", chr, i);
+      if(chr >= 128 || (code = fenPieces[chr]) == 0 || file > FileH) {
+        return FenInvalidPlacement;
       }
-    }
 
-    if(rank < 0) {
-      panic("Too many ranks at position %d.", i);
-    }
-    if(file < 0) {
-      panic("Too many pieces in the file at position %d.", i);
-    }
-
-    pos = POSITION(rank, file);
-    ret.ChessSet.Sets[side].Boards[piece] |= POSBOARD(pos);
+      side = (Side)(code>>3);
+      piece = (Piece)(code&7);
+      pos = POSITION(rank, file);
+      file++;
 
-    ret.ChessSet.Squares[pos] = piece;
+      count = chessSet->PieceCounts[side][piece];
+      if(count == MAX_PIECE_LOCATION) {
+        return FenInvalidPosition;
+      }
 
-    pieceCount = ret.ChessSet.PieceCounts[side][piece];
-    ret.ChessSet.PiecePositionIndexes[pos] = pieceCount;
-    ret.ChessSet.PiecePositions[side][piece][pieceCount] = pos;
-    ret.ChessSet.PieceCounts[side][piece]++;
+      chessSet->Sets[side].Boards[piece] |= POSBOARD(pos);
+      chessSet->Squares[pos] = piece;
+      chessSet->PiecePositionIndexes[pos] = count;
+      chessSet->PiecePositions[side][piece][count] = pos;
+      chessSet->PieceCounts[side][piece]++;
 
-    file++;
+      hash ^= ZobristPositionHash[side][piece][pos];
+      score += PieceSquareScores[side][piece][pos];
+    }
   }
 
-  for(side = White; side <= Black; side++) {
-    if(!seenKing[side]) {
-      panic("No %s king.", StringSide(side));
-    }
+  if(rank != Rank1 || file != FileH + 1) {
+    return FenInvalidPlacement;
   }
 
-  if(i+2 >= len) {
-    panic("FEN string does not contain enough characters to determine position.");
+  pawns = chessSet->Sets[White].Boards[Pawn] | chessSet->Sets[Black].Boards[Pawn];
+  if(chessSet->PieceCounts[White][King] != 1 || chessSet->PieceCounts[Black][King] != 1 ||
+     (pawns & (Rank1Mask | Rank8Mask))) {
+    return FenInvalidPosition;
   }
-  i++;
 
-  // Who's turn.
+  // Side to move.
+  if(!skipSpaces(&curr, end)) {
+    return FenInvalidSide;
+  }
 
-  switch(fen[i]) {
+  switch(*curr++) {
   case 'w':
-    ret.WhosTurn = White;
+    game->WhosTurn = White;
     break;
   case 'b':
-    ret.WhosTurn = Black;
+    game->WhosTurn = Black;
+    hash ^= ZobristBlackHash;
     break;
   default:
-    panic("No turn indicator at position %d.", i);
+    return FenInvalidSide;
   }
 
-  i += 2;
-  if(fen[i] != '-') {
-    for(; i < len && fen[i] != ' '; i++) {
-      chr = fen[i];
-
-      switch(chr) {
-      case 'K':
-        ret.CastlingRights[White][KingSide] = true;
-        break;
-      case 'k':
-        ret.CastlingRights[Black][KingSide] = true;
-        break;
-      case 'Q':
-        ret.CastlingRights[White][QueenSide] = true;
-        break;
-      case 'q':
-        ret.CastlingRights[Black][QueenSide] = true;
-        break;
-      default:
-        panic("Unrecognised character '%c' at position %d.", chr, i);
-      }
-    }
+  if(curr < end && !isFenSpace(*curr)) {
+    return FenInvalidSide;
   }
 
-  // TODO: HACK: We shouldn't need to skip spaces here. Fix up.
-  while(fen[i] == ' ') {
-    i++;
+  if(!skipSpaces(&curr, end) || !parseCastling(game, &curr, end)) {
+    return FenInvalidCastling;
   }
 
-  if(i == len) {
-    panic("FEN '%s' ended without en passant square.", fen);
+  for(side = White; side <= Black; side++) {
+    if(game->CastlingRights[side][KingSide]) {
+      hash ^= ZobristCastlingHash[side][KingSide];
+    }
+    if(game->CastlingRights[side][QueenSide]) {
+      hash ^= ZobristCastlingHash[side][QueenSide];
+    }
   }
 
-  if(fen[i] != '-') {
-    if(len - i < 2) {
-      panic("Not enough space in fen string for non-empty en passant square.");
+  // En passant square, which has to be behind a pawn which has just moved 2 squares.
+  if(!skipSpaces(&curr, end)) {
+    return FenInvalidEnPassant;
+  }
+
+  game->EnPassantSquare = EmptyPosition;
+  if(*curr == '-') {
+    curr++;
+  } else {
+    side = OPPOSITE(game->WhosTurn);
+    rank = side == White ? Rank3 : Rank6;
+
+    if(end - curr < 2 || curr[0] < 'a' || curr[0] > 'h' || curr[1] != '1' + rank) {
+      return FenInvalidEnPassant;
+    }
+
+    pos = POSITION(rank, curr[0] - 'a');
+    if(!(chessSet->Sets[side].Boards[Pawn] & POSBOARD(side == White ? pos + 8 : pos - 8))) {
+      return FenInvalidEnPassant;
     }
 
-    chr = fen[i];
+    game->EnPassantSquare = pos;
+    hash ^= ZobristEnPassantFileHash[FILE(pos)];
+    curr += 2;
+  }
+
+  if(curr < end && !isFenSpace(*curr)) {
+    return FenInvalidEnPassant;
+  }
 
-    if(chr < 'a' || chr > 'h') {
-      panic("Invalid file '%c'.", chr);
+  // Clocks, which many FENs omit.
+  game->HalfMoveClock = 0;
+  game->FullMoveNumber = 1;
+  if(skipSpaces(&curr, end)) {
+    if(!parseNumber(&curr, end, &game->HalfMoveClock)) {
+      return FenInvalidClock;
     }
-    file = chr - 'a';
 
-    if(chr < '1' || chr > '8') {
-      panic("Invalid rank '%c'.", chr);
+    if(skipSpaces(&curr, end)) {
+      if(!parseNumber(&curr, end, &game->FullMoveNumber)) {
+        return FenInvalidClock;
+      }
+
+      // Some databases number moves from 0.
+      if(game->FullMoveNumber == 0) {
+        game->FullMoveNumber = 1;
+      }
     }
-    rank = chr - '1';
+  }
 
-    ret.EnPassantSquare = POSITION(file, rank);
+  if(skipSpaces(&curr, end)) {
+    return FenTrailingCharacters;
   }
 
-  // TODO: Implement parsing of clock times.
+  UpdateOccupancies(chessSet);
 
-  UpdateOccupancies(&ret.ChessSet);
+  game->CheckStats = CalculateCheckStats(game);
 
-  king = BitScanForward(ret.ChessSet.Sets[ret.WhosTurn].Boards[King]);
-  ret.CheckStats = CalculateCheckStats(&ret);
-  ret.CheckStats.CheckSources = AllAttackersTo(&ret.ChessSet, king, ret.ChessSet.Occupancy) &
-    ret.ChessSet.Sets[OPPOSITE(ret.WhosTurn)].Occupancy;
+  // The side which has just moved can't have left its king in check.
+  if(AllAttackersTo(chessSet, game->CheckStats.AttackedKing, chessSet->Occupancy) &
+     chessSet->Sets[game->WhosTurn].Occupancy) {
+    return FenInvalidPosition;
+  }
 
-  ret.Hash = HashGame(&ret);
+  checkers = AllAttackersTo(chessSet, game->CheckStats.DefendedKing, chessSet->Occupancy) &
+    chessSet->Sets[OPPOSITE(game->WhosTurn)].Occupancy;
+  game->CheckStats.CheckSources = checkers;
 
-  return ret;
+  game->Hash = hash;
+  game->Score = score;
+  game->Memories.Curr = game->Memories.Vals;
+
+  return FenOk;
 }
 
 Move
@@ -277,3 +319,94 @@ ParseMove(char *str)
 
   return MAKE_MOVE(from, to, type);
 }
+
+static FORCE_INLINE bool
+isFenSpace(char chr)
+{
+  return chr == ' ' || chr == '\t' || chr == '\n' || chr == '\r';
+}
+
+// Parse castling rights, which are only valid if the king and rook are on their initial squares.
+static bool
+parseCastling(Game *game, const char **curr, const char *end)
+{
+  BitBoard kings, rooks;
+  CastleSide castleSide;
+  Side side;
+
+  for(side = White; side <= Black; side++) {
+    game->CastlingRights[side][KingSide] = false;
+    game->CastlingRights[side][QueenSide] = false;
+  }
+
+  if(**curr == '-') {
+    (*curr)++;
+
+    return *curr == end || isFenSpace(**curr);
+  }
+
+  for(; *curr < end && !isFenSpace(**curr); (*curr)++) {
+    switch(**curr) {
+    case 'K':
+      side = White;
+      castleSide = KingSide;
+      break;
+    case 'Q':
+      side = White;
+      castleSide = QueenSide;
+      break;
+    case 'k':
+      side = Black;
+      castleSide = KingSide;
+      break;
+    case 'q':
+      side = Black;
+      castleSide = QueenSide;
+      break;
+    default:
+      return false;
+    }
+
+    kings = game->ChessSet.Sets[side].Boards[King];
+    rooks = game->ChessSet.Sets[side].Boards[Rook];
+    if(!(kings & POSBOARD(side == White ? E1 : E8)) ||
+       !(rooks & POSBOARD(castleSide == KingSide ? (side == White ? H1 : H8) :
+                          (side == White ? A1 : A8)))) {
+      return false;
+    }
+
+    game->CastlingRights[side][castleSide] = true;
+  }
+
+  return true;
+}
+
+// Parse a non-negative decimal number, which must be followed by a space or the end of the FEN.
+static bool
+parseNumber(const char **curr, const char *end, int *ret)
+{
+  const char *start = *curr;
+  int val = 0;
+
+  for(; *curr < end && **curr >= '0' && **curr <= '9'; (*curr)++) {
+    if(val > (INT_MAX - 9)/10) {
+      return false;
+    }
+    val = 10*val + **curr - '0';
+  }
+
+  *ret = val;
+
+  return *curr > start && (*curr == end || isFenSpace(**curr));
+}
+
+// Skip spaces between fields, returning false if there's no further field.
+static FORCE_INLINE bool
+skipSpaces(const char **curr, const char *end)
+{
+  while(*curr < end && isFenSpace(**curr)) {
+    (*curr)++;
+  }
+
+  return *curr < end;
+}
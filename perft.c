@@ -20,19 +20,221 @@
 */
 
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include "weak.h"
 
 //#define SHOW_MOVES
 
-static PerftStats initStats(void);
+// First line of a checkpoint file, followed by the FEN and depth, then one line per completed
+// subtree giving its index, the moves leading to it and its count.
+#define CHECKPOINT_MAGIC "weak perft checkpoint 1"
+
+#define MAX_PERFT_THREADS 64
+// Work is split into subtrees this many plies below the root, so threads can balance load.
+#define PERFT_SPLIT_DEPTH 2
+
+// A subtree of a parallel perft, identified by the moves leading to it from the root.
+typedef struct PerftWork PerftWork;
+struct PerftWork {
+  Move     Moves[PERFT_SPLIT_DEPTH];
+  int      Length;
+  // Already counted, e.g. by a previous run recorded in a checkpoint.
+  bool     Done;
+  uint64_t Count;
+};
+
+typedef struct PerftThread PerftThread;
+struct PerftThread {
+  Game     Game;
+  uint64_t Nodes;
+};
+
+// Shared between parallel perft threads, each of which claims the next unclaimed item of work
+// until there are none left.
+static PerftWork *perftWork;
+static int perftWorkCount, perftDepth;
+static volatile int nextWork;
+static bool perftHash;
+static PerftThread perftThreads[MAX_PERFT_THREADS];
+// If set, each subtree's count is appended here as it completes, see CheckpointPerft().
+static FILE *checkpointFile;
+// If set, the work items are instead this frontier's entries, see UniquePerft().
+static Frontier *perftFrontier;
+static uint64_t *frontierCounts;
+
+static FORCE_INLINE int claimWork(void);
+static FILE*            createCheckpoint(char*, char*, int);
+static PerftStats       initStats(void);
+static bool             loadCheckpoint(FILE*, char*, int, long*);
+static void*            perftThread(void*);
+static int              prepareWork(Game*, int, int, bool);
+static void             runWork(Game*, int, void *(*)(void*), uint64_t*);
+static void             splitWork(Game*, int, Move*);
+static void*            uniqueThread(void*);
+#if defined(SHOW_MOVES)
+static void       showMove(Game*, Move);
+#endif
+
+// Perft which survives being interrupted, for runs lasting days. Subtrees are counted as by
+// ParallelPerft(), and each count is appended to the checkpoint file at path as soon as it is
+// complete. If the file already exists, the subtrees it records aren't recounted, so rerunning
+// after a crash resumes where the previous run left off. The total is accumulated in 128 bits,
+// though each subtree must fit in 64. Returns false if the checkpoint can't be used. If stats
+// isn't NULL, it's set to why not, or how many subtrees the checkpoint already held.
+bool
+CheckpointPerft(Game *game, int depth, int threads, bool hash, char *path, Uint128 *ret,
+                ResumeStats *stats)
+{
+  char fen[MAX_FEN_LEN];
+  ResumeStats ignored;
+  FILE *file;
+  int i;
+  long valid;
+
+  if(stats == NULL) {
+    stats = &ignored;
+  }
+  stats->Error = CheckpointOk;
+  stats->Resumed = 0;
+  stats->Subtrees = 0;
+
+  ret->Hi = 0;
+  ret->Lo = 0;
+
+  threads = prepareWork(game, depth, threads, hash);
+
+  if(depth <= PERFT_SPLIT_DEPTH) {
+    // Too quick to need checkpointing.
+    ret->Lo = QuickPerft(game, depth);
+
+    return true;
+  }
+
+  WriteFen(game, fen);
+
+  if((file = fopen(path, "r")) != NULL) {
+    if(!loadCheckpoint(file, fen, depth, &valid)) {
+      stats->Error = CheckpointMismatch;
+      fclose(file);
+      release(perftWork);
+
+      return false;
+    }
+    fclose(file);
+
+    // Drop any partly written line, so what we append starts on a line of its own.
+    if(truncate(path, valid) == 0) {
+      checkpointFile = fopen(path, "a");
+    }
+  } else {
+    checkpointFile = createCheckpoint(path, fen, depth);
+  }
+
+  if(checkpointFile == NULL) {
+    stats->Error = CheckpointUnwritable;
+    release(perftWork);
+
+    return false;
+  }
+
+  for(i = 0; i < perftWorkCount; i++) {
+    stats->Resumed += perftWork[i].Done;
+  }
+  stats->Subtrees = perftWorkCount;
+
+  runWork(game, threads, perftThread, NULL);
+
+  fclose(checkpointFile);
+  checkpointFile = NULL;
+
+  for(i = 0; i < perftWorkCount; i++) {
+    AddUint128(ret, perftWork[i].Count);
+  }
+
+  release(perftWork);
+
+  return true;
+}
+
+// Perft, outputting each root move followed by the number of leaf nodes beneath it, for
+// comparison with other move generators. If hash is set, subtrees are counted with HashPerft(),
+// otherwise with QuickPerft(). Output is buffered, so call FlushOutput() afterwards.
+uint64_t
+DividePerft(Game *game, int depth, bool hash)
+{
+  char str[FORMAT_MOVE_LEN + 32];
+  int len;
+  Move *curr, *end;
+  Move buffer[INIT_MOVE_LEN];
+  uint64_t count, ret = 0;
+
+  end = AllMoves(buffer, game);
+
+  for(curr = buffer; curr < end; curr++) {
+    if(depth <= 1) {
+      count = 1;
+    } else {
+      DoMove(game, *curr);
+      count = hash ? HashPerft(game, depth - 1, true) : QuickPerft(game, depth - 1);
+      Unmove(game);
+    }
+
+    len = FormatMove(*curr, str);
+    len += sprintf(str + len, ": %lu\n", count);
+    Output(str, len);
+
+    ret += count;
+  }
+
+  return ret;
+}
+
+// Perft which caches subtree node counts in the transposition table. If prefetch is set, we
+// prefetch the table clusters for every child position before descending into any of them, so
+// lookups further along the move list are likely to hit cache.
+uint64_t
+HashPerft(Game *game, int depth, bool prefetch)
+{
+  Move *curr, *end;
+  Move buffer[INIT_MOVE_LEN];
+  TransEntry entry;
+  uint64_t ret = 0;
+
+  // Leaf counts are cheaper to generate than to look up.
+  if(depth <= 1) {
+    return QuickPerft(game, depth);
+  }
+
+  if(LookupPosition(game->Hash, &entry) && entry.Depth == depth &&
+     (entry.GenBound&BOUND_MASK) == PerftBound) {
+    return (uint64_t)entry.Value;
+  }
+
+  end = AllMoves(buffer, game);
+  PROFILE_COUNT(MoveCounts[end - buffer]);
+
+  // Children at depth 1 don't look anything up.
+  if(prefetch && depth > 2) {
+    for(curr = buffer; curr < end; curr++) {
+      PrefetchTrans(HashAfter(game, *curr));
+    }
+  }
+
+  for(curr = buffer; curr < end; curr++) {
+    DoMove(game, *curr);
+    ret += HashPerft(game, depth - 1, prefetch);
+    Unmove(game);
+  }
+
+  SavePosition(game->Hash, (int64_t)ret, INVALID_MOVE, depth, PerftBound);
+
+  return ret;
+}
 
 uint64_t
 QuickPerft(Game *game, int depth)
 {
-#if defined(SHOW_MOVES)
-  bool capture;
-  Piece piece;
-#endif
   Move move;
   Move *curr, *end;
   Move buffer[INIT_MOVE_LEN];
@@ -40,21 +242,12 @@ QuickPerft(Game *game, int depth)
   uint64_t ret = 0;
 
   end = AllMoves(buffer, game);
+  PROFILE_COUNT(MoveCounts[end - buffer]);
 
   if(depth <= 1) {
 #if defined(SHOW_MOVES)
     for(curr = buffer; curr < end; curr++) {
-      move = *curr;
-
-      piece = PieceAt(&game->ChessSet, FROM(move));
-
-      if(TYPE(move) == EnPassant) {
-        capture = true;
-      } else {
-        capture = PieceAt(&game->ChessSet, TO(move)) != MissingPiece;
-      }
-
-      puts(StringMove(move, piece, capture));
+      showMove(game, *curr);
     }
 #endif
 
@@ -72,13 +265,42 @@ QuickPerft(Game *game, int depth)
   return ret;
 }
 
+// Perft over the specified number of threads, each playing its own copy of the game. The tree is
+// split into the subtrees PERFT_SPLIT_DEPTH plies down, which threads claim one at a time. If hash
+// is set subtrees are counted with HashPerft(), sharing the transposition table. If threadNodes is
+// non-NULL, the nodes counted by each thread are stored there.
+uint64_t
+ParallelPerft(Game *game, int depth, int threads, bool hash, uint64_t *threadNodes)
+{
+  int i;
+  uint64_t ret = 0;
+
+  threads = prepareWork(game, depth, threads, hash);
+
+  if(depth <= PERFT_SPLIT_DEPTH) {
+    // Too shallow to be worth splitting.
+    ret = QuickPerft(game, depth);
+    for(i = 0; threadNodes != NULL && i < threads; i++) {
+      threadNodes[i] = i == 0 ? ret : 0;
+    }
+
+    return ret;
+  }
+
+  runWork(game, threads, perftThread, threadNodes);
+
+  for(i = 0; i < perftWorkCount; i++) {
+    ret += perftWork[i].Count;
+  }
+
+  release(perftWork);
+
+  return ret;
+}
+
 PerftStats
 Perft(Game *game, int depth)
 {
-#if defined(SHOW_MOVES)
-  bool capture;
-  Piece piece;
-#endif
   Move move;
   Move buffer[INIT_MOVE_LEN];
   Move *curr, *end;
@@ -91,21 +313,14 @@ Perft(Game *game, int depth)
   ret = initStats();
 
   end = AllMoves(buffer, game);
+  PROFILE_COUNT(MoveCounts[end - buffer]);
 
   for(curr = buffer; curr != end; curr++) {
     move = *curr;
 
     if(depth == 1) {
 #if defined(SHOW_MOVES)
-      piece = PieceAt(&game->ChessSet, FROM(move));
-
-      if(TYPE(move) == EnPassant) {
-        capture = true;
-      } else {
-        capture = PieceAt(&game->ChessSet, TO(move)) != MissingPiece;
-      }
-
-      puts(StringMove(move, piece, capture));
+      showMove(game, move);
 #endif
       ret.Count++;
       /*
@@ -159,6 +374,65 @@ Perft(Game *game, int depth)
   return ret;
 }
 
+// Perft over the distinct positions split plies below the root, see CollectFrontier(). Each is
+// counted once, by whichever of the threads claims it, and weighted by how many move sequences
+// reach it, so transpositions near the root are only counted once. The total is accumulated in
+// 128 bits. If stats is non-NULL, the size of the frontier is stored there.
+void
+UniquePerft(Game *game, int depth, int split, int threads, bool hash, Uint128 *ret,
+            FrontierStats *stats)
+{
+  Frontier frontier;
+  int i;
+
+  ret->Hi = 0;
+  ret->Lo = 0;
+  if(stats != NULL) {
+    stats->Count = 0;
+  }
+
+  if(split > MAX_FRONTIER_DEPTH) {
+    split = MAX_FRONTIER_DEPTH;
+  }
+  if(split < 1 || split >= depth) {
+    ret->Lo = QuickPerft(game, depth);
+    return;
+  }
+
+  threads = prepareWork(NULL, depth, threads, hash);
+
+  frontier = CollectFrontier(game, split);
+  if(stats != NULL) {
+    stats->Count = frontier.Count;
+    stats->Depth = split;
+    stats->Positions = frontier.Positions;
+  }
+
+  perftFrontier = &frontier;
+  perftWorkCount = frontier.Count;
+  frontierCounts = (uint64_t*)allocate(sizeof(uint64_t), frontier.Count);
+
+  runWork(game, threads, uniqueThread, NULL);
+
+  for(i = 0; i < frontier.Count; i++) {
+    AddProductUint128(ret, frontierCounts[i], frontier.Entries[i].Multiplicity);
+  }
+
+  release(frontierCounts);
+  ReleaseFrontier(&frontier);
+  perftFrontier = NULL;
+}
+
+static FORCE_INLINE int
+claimWork()
+{
+#ifdef USE_THREAD
+  return FetchAdd(&nextWork, 1);
+#else
+  return nextWork++;
+#endif
+}
+
 static PerftStats
 initStats()
 {
@@ -174,3 +448,260 @@ initStats()
 
   return ret;
 }
+
+// Mark the subtrees recorded in a checkpoint as done, setting valid to the length of the file up
+// to the end of the last intact line. Returns false if the checkpoint doesn't match the position
+// and depth, or its subtrees don't match ours. A final line without a newline was cut short, and
+// is ignored.
+static bool
+loadCheckpoint(FILE *file, char *fen, int depth, long *valid)
+{
+  char line[MAX_FEN_LEN + 32];
+  char end;
+  int i, checkpointDepth;
+  unsigned move1, move2;
+  unsigned long count;
+
+  if(fgets(line, sizeof(line), file) == NULL || strcmp(line, CHECKPOINT_MAGIC "\n") != 0) {
+    return false;
+  }
+
+  if(fgets(line, sizeof(line), file) == NULL || strncmp(line, fen, strlen(fen)) != 0 ||
+     line[strlen(fen)] != '\n') {
+    return false;
+  }
+
+  if(fgets(line, sizeof(line), file) == NULL || sscanf(line, "%d", &checkpointDepth) != 1 ||
+     checkpointDepth != depth) {
+    return false;
+  }
+
+  *valid = ftell(file);
+
+  while(fgets(line, sizeof(line), file) != NULL) {
+    if(sscanf(line, "%d %u %u %lu%c", &i, &move1, &move2, &count, &end) != 5 || end != '\n') {
+      break;
+    }
+
+    if(i < 0 || i >= perftWorkCount || perftWork[i].Moves[0] != move1 ||
+       perftWork[i].Moves[1] != move2) {
+      return false;
+    }
+
+    perftWork[i].Done = true;
+    perftWork[i].Count = count;
+    *valid = ftell(file);
+  }
+
+  return true;
+}
+
+// Create a checkpoint at path holding only its header, and open it for appending. The header is
+// synced under a temporary name and renamed into place, so a crash can't leave a checkpoint
+// whose header is missing or torn, which loadCheckpoint() would reject forever. Returns NULL if
+// it can't be created.
+static FILE*
+createCheckpoint(char *path, char *fen, int depth)
+{
+  char *tmpPath;
+  FILE *file;
+  bool ok;
+
+  tmpPath = allocate(sizeof(char), strlen(path) + sizeof(".tmp"));
+  sprintf(tmpPath, "%s.tmp", path);
+
+  if((file = fopen(tmpPath, "w")) == NULL) {
+    release(tmpPath);
+
+    return NULL;
+  }
+
+  ok = fprintf(file, "%s\n%s\n%d\n", CHECKPOINT_MAGIC, fen, depth) > 0 && fflush(file) == 0 &&
+    fsync(fileno(file)) == 0;
+  ok = fclose(file) == 0 && ok && rename(tmpPath, path) == 0;
+
+  if(!ok) {
+    remove(tmpPath);
+  }
+  release(tmpPath);
+
+  return ok ? fopen(path, "a") : NULL;
+}
+
+// Count claimed subtrees until there are none left.
+static void*
+perftThread(void *arg)
+{
+  int i, j;
+  PerftThread *thread = (PerftThread*)arg;
+  PerftWork *work;
+  uint64_t count;
+
+  while((i = claimWork()) < perftWorkCount) {
+    work = &perftWork[i];
+
+    if(work->Done) {
+      continue;
+    }
+
+    for(j = 0; j < work->Length; j++) {
+      DoMove(&thread->Game, work->Moves[j]);
+    }
+
+    count = perftHash ?
+      HashPerft(&thread->Game, perftDepth - work->Length, true) :
+      QuickPerft(&thread->Game, perftDepth - work->Length);
+
+    for(j = 0; j < work->Length; j++) {
+      Unmove(&thread->Game);
+    }
+
+    work->Count = count;
+    thread->Nodes += count;
+
+    if(checkpointFile != NULL) {
+      // Stdio locks the stream, so lines from different threads don't interleave.
+      fprintf(checkpointFile, "%d %u %u %lu\n", i, work->Moves[0], work->Moves[1], count);
+      fflush(checkpointFile);
+      fsync(fileno(checkpointFile));
+    }
+  }
+
+  return NULL;
+}
+
+// Set up the parallel perft shared state and, if game is given and depth is large enough to
+// split, the work list. Returns the number of threads to use.
+static int
+prepareWork(Game *game, int depth, int threads, bool hash)
+{
+  Move path[PERFT_SPLIT_DEPTH];
+
+  if(threads < 1) {
+    threads = 1;
+  } else if(threads > MAX_PERFT_THREADS) {
+    threads = MAX_PERFT_THREADS;
+  }
+
+  perftDepth = depth;
+  perftHash = hash;
+  perftWorkCount = 0;
+  nextWork = 0;
+
+  if(game != NULL && depth > PERFT_SPLIT_DEPTH) {
+    perftWork = allocate(sizeof(PerftWork), INIT_MOVE_LEN*INIT_MOVE_LEN);
+    splitWork(game, 0, path);
+  }
+
+  return threads;
+}
+
+// Count all outstanding work over the specified number of threads, each running fn.
+static void
+runWork(Game *game, int threads, void *(*fn)(void*), uint64_t *threadNodes)
+{
+  int i;
+
+  for(i = 0; i < threads; i++) {
+    perftThreads[i].Game = CopyGame(game);
+    perftThreads[i].Nodes = 0;
+  }
+
+  if(threads == 1) {
+    fn(&perftThreads[0]);
+  }
+#ifdef USE_THREAD
+  else if(!RunThreads(threads, fn, perftThreads, sizeof(PerftThread))) {
+    // Whichever threads did start have finished, so pick up anything they didn't get to.
+    fn(&perftThreads[0]);
+  }
+#else
+  else {
+    fn(&perftThreads[0]);
+  }
+#endif
+
+  for(i = 0; i < threads; i++) {
+    if(threadNodes != NULL) {
+      threadNodes[i] = perftThreads[i].Nodes;
+    }
+    ReleaseGame(&perftThreads[i].Game);
+  }
+}
+
+// Add the subtrees PERFT_SPLIT_DEPTH - ply plies below the current position to the work list.
+static void
+splitWork(Game *game, int ply, Move *path)
+{
+  Move *curr, *end;
+  Move buffer[INIT_MOVE_LEN];
+
+  if(ply == PERFT_SPLIT_DEPTH) {
+    memcpy(perftWork[perftWorkCount].Moves, path, ply*sizeof(Move));
+    perftWork[perftWorkCount].Length = ply;
+    perftWork[perftWorkCount].Done = false;
+    perftWork[perftWorkCount].Count = 0;
+    perftWorkCount++;
+
+    return;
+  }
+
+  end = AllMoves(buffer, game);
+
+  for(curr = buffer; curr < end; curr++) {
+    path[ply] = *curr;
+
+    DoMove(game, *curr);
+    splitWork(game, ply + 1, path);
+    Unmove(game);
+  }
+}
+
+// Count claimed frontier entries until there are none left.
+static void*
+uniqueThread(void *arg)
+{
+  int i, j;
+  PerftThread *thread = (PerftThread*)arg;
+  uint64_t count;
+
+  while((i = claimWork()) < perftWorkCount) {
+    PlayFrontierEntry(&thread->Game, perftFrontier, i);
+
+    count = perftHash ?
+      HashPerft(&thread->Game, perftDepth - perftFrontier->Depth, true) :
+      QuickPerft(&thread->Game, perftDepth - perftFrontier->Depth);
+
+    for(j = 0; j < perftFrontier->Depth; j++) {
+      Unmove(&thread->Game);
+    }
+
+    frontierCounts[i] = count;
+    thread->Nodes += count;
+  }
+
+  return NULL;
+}
+
+#if defined(SHOW_MOVES)
+// Output a leaf move in long algebraic form. Buffered, as there are a great many of them.
+static void
+showMove(Game *game, Move move)
+{
+  bool capture;
+  char str[FORMAT_MOVE_FULL_LEN];
+  int len;
+  Piece piece = PieceAt(&game->ChessSet, FROM(move));
+
+  if(TYPE(move) == EnPassant) {
+    capture = true;
+  } else {
+    capture = PieceAt(&game->ChessSet, TO(move)) != MissingPiece;
+  }
+
+  len = FormatMoveFull(move, piece, capture, str);
+  // Replace the terminating null.
+  str[len++] = '\n';
+  Output(str, len);
+}
+#endif
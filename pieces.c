@@ -44,6 +44,36 @@ AllAttackersTo(ChessSet *chessSet, Position pos, BitBoard occupancy)
     kingAttackersTo(chessSet, pos);
 }
 
+// Determine every square attacked by the specified side, given the specified occupancy. Sliders
+// are filled set-wise by SlidingAttacks() rather than looked up one at a time.
+BitBoard
+AllAttacksFrom(ChessSet *chessSet, Side side, BitBoard occupancy)
+{
+  BitBoard bishopish, pawns, rookish;
+  BitBoard ret;
+  Position *positions;
+
+  pawns = chessSet->Sets[side].Boards[Pawn];
+  if(side == White) {
+    ret = NoWeOne(pawns) | NoEaOne(pawns);
+  } else {
+    ret = SoWeOne(pawns) | SoEaOne(pawns);
+  }
+
+  for(positions = chessSet->PiecePositions[side][Knight]; *positions != EmptyPosition;
+      positions++) {
+    ret |= knightSquares[*positions];
+  }
+
+  bishopish = chessSet->Sets[side].Boards[Bishop] | chessSet->Sets[side].Boards[Queen];
+  rookish = chessSet->Sets[side].Boards[Rook] | chessSet->Sets[side].Boards[Queen];
+  ret |= SlidingAttacks(rookish, bishopish, occupancy);
+
+  ret |= kingSquares[BitScanForward(chessSet->Sets[side].Boards[King])];
+
+  return ret;
+}
+
 BitBoard
 BishopAttacksFrom(Position bishop, BitBoard occupancy)
 {
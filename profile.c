@@ -0,0 +1,111 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "weak.h"
+
+// Move list length histogram buckets are this wide when printed.
+#define PROFILE_BUCKET_WIDTH 8
+
+#if defined(PROFILE)
+Profile Profiling;
+
+static double percent(uint64_t, uint64_t);
+#endif
+
+// Print the counters collected by a PROFILE build to stderr. Does nothing otherwise.
+void
+PrintProfile()
+{
+#if defined(PROFILE)
+  char *checkStatsNames[CheckStatsFieldCount] = {
+    "CheckSquares", "Discovered", "Pinned", "Threats"
+  };
+  char *pathNames[DoMovePathCount] = {
+    "Quiet", "Double push", "Capture", "En passant", "Castle king side",
+    "Castle queen side", "Promotion", "Capture promotion"
+  };
+  CheckStatsField field;
+  DoMovePath path;
+  int i, j;
+  uint64_t bucket, moves = 0, nodes = 0, positions;
+  uint64_t generated = Profiling.EvasionNodes + Profiling.NonEvasionNodes;
+  uint64_t doMoves = 0;
+
+  fprintf(stderr, "AllMoves for %lu positions:-\n", generated);
+  fprintf(stderr, "Evasions     %12lu (%5.1f%%)\n", Profiling.EvasionNodes,
+          percent(Profiling.EvasionNodes, generated));
+  fprintf(stderr, "Non-evasions %12lu (%5.1f%%)\n", Profiling.NonEvasionNodes,
+          percent(Profiling.NonEvasionNodes, generated));
+  fprintf(stderr, "Pseudo-legal %12lu, rejected %lu (%.2f%%)\n", Profiling.PseudoLegalMoves,
+          Profiling.PseudoLegalRejected,
+          percent(Profiling.PseudoLegalRejected, Profiling.PseudoLegalMoves));
+
+  for(i = 0; i <= INIT_MOVE_LEN; i++) {
+    nodes += Profiling.MoveCounts[i];
+    moves += i*Profiling.MoveCounts[i];
+  }
+
+  fprintf(stderr, "\nPerft move lists for %lu positions, mean length %.2f:-\n", nodes,
+          nodes > 0 ? (double)moves/nodes : 0);
+  for(i = 0; i <= INIT_MOVE_LEN; i += PROFILE_BUCKET_WIDTH) {
+    bucket = 0;
+    for(j = i; j < i + PROFILE_BUCKET_WIDTH && j <= INIT_MOVE_LEN; j++) {
+      bucket += Profiling.MoveCounts[j];
+    }
+
+    if(bucket > 0) {
+      fprintf(stderr, "%3d-%-3d %12lu (%5.1f%%)\n", i, i + PROFILE_BUCKET_WIDTH - 1, bucket,
+              percent(bucket, nodes));
+    }
+  }
+
+  for(path = QuietPath; path < DoMovePathCount; path++) {
+    doMoves += Profiling.DoMovePaths[path];
+  }
+
+  fprintf(stderr, "\nDoMove for %lu moves, giving check %lu (%.1f%%):-\n", doMoves,
+          Profiling.DoMoveChecks, percent(Profiling.DoMoveChecks, doMoves));
+  for(path = QuietPath; path < DoMovePathCount; path++) {
+    fprintf(stderr, "%-17s %12lu (%5.1f%%)\n", pathNames[path], Profiling.DoMovePaths[path],
+            percent(Profiling.DoMovePaths[path], doMoves));
+  }
+
+  positions = Profiling.CheckStatsPositions > 0 ? Profiling.CheckStatsPositions : 1;
+
+  fprintf(stderr, "\nCheckStats for %lu positions:-\n", Profiling.CheckStatsPositions);
+  for(field = CheckSquaresField; field < CheckStatsFieldCount; field++) {
+    fprintf(stderr, "%-13s consumed %12lu (%6.3f/position), calculated %12lu (%5.1f%%)\n",
+            checkStatsNames[field], Profiling.CheckStatsConsumed[field],
+            (double)Profiling.CheckStatsConsumed[field]/positions,
+            Profiling.CheckStatsCalculated[field],
+            100.0*Profiling.CheckStatsCalculated[field]/positions);
+  }
+#endif
+}
+
+#if defined(PROFILE)
+static double
+percent(uint64_t count, uint64_t total)
+{
+  return total > 0 ? 100.0*count/total : 0;
+}
+#endif
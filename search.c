@@ -0,0 +1,729 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Derived from Stockfish search.
+
+#include <string.h>
+#include <time.h>
+#include "weak.h"
+
+// How often the monitor thread checks the search's limits.
+#define MONITOR_INTERVAL_NS 1000000
+
+// Searches running at once share the transposition table, which is how they help each other -
+// so called 'Lazy SMP'.
+#define MAX_SEARCH_THREADS 64
+
+// Killer moves remembered per ply.
+#define KILLER_COUNT 2
+
+// Move ordering scores. History scores lie in [0, HISTORY_MAX), below killers.
+#define TRANS_MOVE_SCORE   (1<<30)
+#define GOOD_CAPTURE_SCORE (1<<28)
+#define KILLER_SCORE       (1<<27)
+#define HISTORY_MAX        (1<<20)
+#define BAD_CAPTURE_SCORE  (-(1<<28))
+
+typedef struct SearchThread SearchThread;
+
+struct SearchThread {
+  Game     Game;
+  Move     Best;
+  int      CompletedDepth, Id, MaxDepth, Value;
+  uint64_t Nodes;
+  // Quiet moves which most recently caused a beta cutoff at each ply.
+  Move     Killers[MAX_PLY][KILLER_COUNT];
+  // Butterfly history - how much each quiet move, by side, from and to, has caused cutoffs.
+  int      History[2][64][64];
+} CACHE_ALIGNED;
+
+// Set by the main thread once it has completed its search, or by the monitor thread once a limit
+// is reached, at which point threads abandon their searches.
+static volatile bool stopSearch = false;
+
+// Set once there's unlikely to be time to complete another iteration, so threads finish rather
+// than start one.
+static volatile bool stopIterating = false;
+
+// searchDone tells the monitor thread to exit, monitorRunning is cleared when it has.
+static volatile bool monitorRunning = false, searchDone = false;
+
+static SearchLimits searchLimits;
+static int          searchThreadCount;
+static uint64_t     searchStart;
+
+// Static so each thread's state is cache line aligned, avoiding false sharing.
+static SearchThread searchThreads[MAX_SEARCH_THREADS];
+
+// Whether quiescence search skips captures which lose material, see UseSeePruning().
+static bool seePruning = true;
+
+// Whether quiet moves are ordered by killers and history, see UseHistoryOrdering().
+static bool historyOrdering = true;
+
+static int                  alphaBeta(SearchThread*, int, int, int, int);
+static void                 checkLimits(void);
+static FORCE_INLINE bool    isTactical(Game*, Move);
+static void*                monitorThread(void*);
+static int                  quiesce(SearchThread*, int, int, int);
+static FORCE_INLINE void    scoreMoves(SearchThread*, Move*, int*, int, Move, int);
+static bool                 searchRoot(SearchThread*, Move*, int*, int);
+static void*                searchThread(void*);
+static FORCE_INLINE void    selectBest(Move*, int*, int);
+static FORCE_INLINE void    updateQuietStats(SearchThread*, Move, int, int);
+static FORCE_INLINE int     valueFromTrans(int64_t, int);
+static FORCE_INLINE int64_t valueToTrans(int, int);
+static Move                 vote(SearchThread*, int, int*);
+
+// Limits SearchLimited() uses when none are specified - search for MAX_THINK_SECS.
+SearchLimits
+DefaultSearchLimits()
+{
+  SearchLimits ret;
+
+  ret.Depth = 0;
+  ret.Nodes = 0;
+  ret.Millis = MAX_THINK_SECS*1000;
+
+  return ret;
+}
+
+// Search the game to the specified depth in plies, returning the best move and setting value to
+// its score from the point of view of the side to move. nodes is incremented for every position
+// visited.
+Move
+Search(Game *game, uint64_t *nodes, int *value, int depth)
+{
+  return SearchThreads(game, nodes, value, depth, 1);
+}
+
+// Search as above, stopping at whichever of the specified limits is reached first, using the
+// specified number of threads. If limits is NULL, DefaultSearchLimits() apply. We always complete
+// at least a 1 ply search.
+Move
+SearchLimited(Game *game, SearchLimits *limits, uint64_t *nodes, int *value, int threads)
+{
+  int i;
+  Move ret;
+  SearchLimits defaults;
+  struct timespec interval = { 0, MONITOR_INTERVAL_NS };
+
+  if(limits == NULL) {
+    defaults = DefaultSearchLimits();
+    limits = &defaults;
+  }
+
+  if(threads < 1) {
+    threads = 1;
+  } else if(threads > MAX_SEARCH_THREADS) {
+    threads = MAX_SEARCH_THREADS;
+  }
+
+  NextSearchTrans();
+  stopSearch = false;
+  stopIterating = false;
+  searchDone = false;
+
+  searchLimits = *limits;
+  searchThreadCount = threads;
+  searchStart = NanoTime();
+
+  for(i = 0; i < threads; i++) {
+    searchThreads[i].Game = CopyGame(game);
+    searchThreads[i].Best = INVALID_MOVE;
+    searchThreads[i].CompletedDepth = 0;
+    searchThreads[i].Id = i;
+    searchThreads[i].MaxDepth = limits->Depth > 0 && limits->Depth < MAX_PLY ?
+      limits->Depth : MAX_PLY;
+    searchThreads[i].Value = 0;
+    searchThreads[i].Nodes = 0;
+    memset(searchThreads[i].Killers, 0, sizeof(searchThreads[i].Killers));
+    memset(searchThreads[i].History, 0, sizeof(searchThreads[i].History));
+  }
+
+  // If we can't start the monitor, the main thread still checks limits between iterations.
+  monitorRunning = false;
+#ifdef USE_THREAD
+  if(limits->Nodes > 0 || limits->Millis > 0) {
+    // The monitor doesn't exit until searchDone is set, so there's no race here.
+    monitorRunning = CreateThread(monitorThread, NULL);
+  }
+#endif
+
+  if(threads == 1) {
+    searchThread(&searchThreads[0]);
+  }
+#ifdef USE_THREAD
+  // Threads are started in order, so if the main thread failed to start, none did.
+  else if(!RunThreads(threads, searchThread, searchThreads, sizeof(SearchThread)) &&
+          searchThreads[0].Nodes == 0) {
+    searchThread(&searchThreads[0]);
+  }
+#else
+  else {
+    searchThread(&searchThreads[0]);
+  }
+#endif
+
+  searchDone = true;
+  while(monitorRunning) {
+    nanosleep(&interval, NULL);
+  }
+
+  ret = vote(searchThreads, threads, value);
+
+  for(i = 0; i < threads; i++) {
+    *nodes += searchThreads[i].Nodes;
+    ReleaseGame(&searchThreads[i].Game);
+  }
+
+  return ret;
+}
+
+// Search to a fixed depth, using the specified number of threads.
+Move
+SearchThreads(Game *game, uint64_t *nodes, int *value, int depth, int threads)
+{
+  SearchLimits limits;
+
+  limits.Depth = depth;
+  limits.Nodes = 0;
+  limits.Millis = 0;
+
+  return SearchLimited(game, &limits, nodes, value, threads);
+}
+
+// Determine whether quiet moves are ordered by killer moves and the history table. Intended for
+// measuring the effect of doing so.
+void
+UseHistoryOrdering(bool use)
+{
+  historyOrdering = use;
+}
+
+// Determine whether quiescence search skips captures with a negative static exchange evaluation.
+// Intended for measuring the effect of doing so.
+void
+UseSeePruning(bool use)
+{
+  seePruning = use;
+}
+
+static int
+alphaBeta(SearchThread *thread, int alpha, int beta, int depth, int ply)
+{
+  Bound bound;
+  Game *game = &thread->Game;
+  int count, extension, i, origAlpha = alpha, val, best = SMALL;
+  int scores[INIT_MOVE_LEN];
+  Move move, bestMove = INVALID_MOVE, transMove = INVALID_MOVE;
+  Move buffer[INIT_MOVE_LEN];
+  TransEntry entry;
+
+  if(depth <= 0) {
+    return quiesce(thread, alpha, beta, ply);
+  }
+
+  thread->Nodes++;
+
+  // The result will be discarded, so don't waste time on it.
+  if(stopSearch) {
+    return 0;
+  }
+
+  // A single repetition is scored as a draw - if repeating was best once, it will be again.
+  if(Repeated(game) || FiftyMoveDraw(game)) {
+    return 0;
+  }
+
+  if(ply >= MAX_PLY) {
+    return Evaluate(game);
+  }
+
+  // Mate distance pruning - we can't do better than mating right now, nor worse than being
+  // mated right now.
+  if(alpha < -MATE + ply) {
+    alpha = -MATE + ply;
+  }
+  if(beta > MATE - ply - 1) {
+    beta = MATE - ply - 1;
+  }
+  if(alpha >= beta) {
+    return alpha;
+  }
+
+  if(LookupPosition(game->Hash, &entry)) {
+    transMove = entry.QuickMove;
+
+    if(entry.Depth >= depth) {
+      val = valueFromTrans(entry.Value, ply);
+      bound = (Bound)(entry.GenBound&BOUND_MASK);
+
+      // A PerftBound entry holds a node count rather than a score, so never cuts off.
+      if(bound == ExactBound ||
+         (bound == LowerBound && val >= beta) ||
+         (bound == UpperBound && val <= alpha)) {
+        return val;
+      }
+    }
+  }
+
+  count = AllMoves(buffer, game) - buffer;
+
+  if(count == 0) {
+    return Checked(game) ? -MATE + ply : 0;
+  }
+
+  scoreMoves(thread, buffer, scores, count, transMove, ply);
+
+  for(i = 0; i < count; i++) {
+    // Moves are picked lazily, as a cutoff often means most are never searched.
+    selectBest(buffer + i, scores + i, count - i);
+    move = buffer[i];
+
+    // Check extension - look one ply deeper after any checking move, so mates which end in
+    // check are always seen.
+    extension = GivesCheck(game, move) ? 1 : 0;
+
+    DoMove(game, move);
+    val = -alphaBeta(thread, -beta, -alpha, depth - 1 + extension, ply + 1);
+    Unmove(game);
+
+    if(stopSearch) {
+      return 0;
+    }
+
+    if(val > best) {
+      best = val;
+      bestMove = move;
+
+      if(val > alpha) {
+        alpha = val;
+
+        if(alpha >= beta) {
+          if(historyOrdering && !isTactical(game, move)) {
+            updateQuietStats(thread, move, depth, ply);
+          }
+          break;
+        }
+      }
+    }
+  }
+
+  if(best >= beta) {
+    bound = LowerBound;
+  } else if(best > origAlpha) {
+    bound = ExactBound;
+  } else {
+    bound = UpperBound;
+  }
+
+  SavePosition(game->Hash, valueToTrans(best, ply), bestMove, depth, bound);
+
+  return best;
+}
+
+// Stop the search if it has reached a node or time limit. Once half the time has gone, we stop
+// starting new iterations. Nothing is stopped until the main thread has completed 1 ply, so we
+// always have a move.
+static void
+checkLimits()
+{
+  int i;
+  uint64_t elapsed, nodes = 0;
+
+  if(searchThreads[0].CompletedDepth == 0) {
+    return;
+  }
+
+  if(searchLimits.Millis > 0) {
+    elapsed = (NanoTime() - searchStart)/1000000;
+
+    if(elapsed >= searchLimits.Millis) {
+      stopIterating = true;
+      stopSearch = true;
+    } else if(2*elapsed >= searchLimits.Millis) {
+      stopIterating = true;
+    }
+  }
+
+  if(searchLimits.Nodes > 0) {
+    for(i = 0; i < searchThreadCount; i++) {
+      nodes += searchThreads[i].Nodes;
+    }
+
+    if(nodes >= searchLimits.Nodes) {
+      stopIterating = true;
+      stopSearch = true;
+    }
+  }
+}
+
+// Determine whether the move is a capture or promotion, which are ordered by SEE rather than
+// by killers and history.
+static FORCE_INLINE bool
+isTactical(Game *game, Move move)
+{
+  return PieceAt(&game->ChessSet, TO(move)) != MissingPiece || TYPE(move) == EnPassant ||
+    (TYPE(move)&PromoteMask) != 0;
+}
+
+// Periodically check the search's limits until it's done.
+static void*
+monitorThread(void *arg)
+{
+  struct timespec interval = { 0, MONITOR_INTERVAL_NS };
+
+  (void)arg;
+
+  while(!searchDone) {
+    nanosleep(&interval, NULL);
+    checkLimits();
+  }
+
+  monitorRunning = false;
+
+  return NULL;
+}
+
+// Search captures until the position is quiet, so we never evaluate in the middle of an exchange.
+// Captures which SEE determines lose material are skipped without ever being played.
+static int
+quiesce(SearchThread *thread, int alpha, int beta, int ply)
+{
+  Game *game = &thread->Game;
+  bool checked = Checked(game);
+  int best, i, count, val;
+  int sees[INIT_MOVE_LEN];
+  Move move;
+  Move *end;
+  Move buffer[INIT_MOVE_LEN];
+
+  thread->Nodes++;
+
+  if(stopSearch) {
+    return 0;
+  }
+
+  if(ply >= MAX_PLY) {
+    return Evaluate(game);
+  }
+
+  // When in check every evasion has to be considered, and we can't assume we could instead
+  // 'stand pat' on the static evaluation.
+  if(checked) {
+    end = AllMoves(buffer, game);
+
+    if(end == buffer) {
+      return -MATE + ply;
+    }
+
+    best = SMALL;
+  } else {
+    best = Evaluate(game);
+    if(best >= beta) {
+      return best;
+    }
+    if(best > alpha) {
+      alpha = best;
+    }
+
+    end = AllCaptures(buffer, game);
+  }
+
+  // Score captures by SEE, dropping losing ones. Evasions are kept regardless.
+  count = 0;
+  for(i = 0; i < end - buffer; i++) {
+    sees[count] = See(game, buffer[i]);
+
+    if(checked || !seePruning || sees[count] >= 0) {
+      buffer[count++] = buffer[i];
+    }
+  }
+
+  for(i = 0; i < count; i++) {
+    // Search the best remaining exchange next.
+    selectBest(buffer + i, sees + i, count - i);
+    move = buffer[i];
+
+    DoMove(game, move);
+    val = -quiesce(thread, -beta, -alpha, ply + 1);
+    Unmove(game);
+
+    if(stopSearch) {
+      return 0;
+    }
+
+    if(val > best) {
+      best = val;
+
+      if(val > alpha) {
+        alpha = val;
+
+        if(alpha >= beta) {
+          break;
+        }
+      }
+    }
+  }
+
+  return best;
+}
+
+// Score moves for ordering - the transposition table move first, then captures and promotions
+// which SEE finds don't lose material, then killers, then quiet moves by history, and finally
+// losing captures.
+static FORCE_INLINE void
+scoreMoves(SearchThread *thread, Move *moves, int *scores, int count, Move transMove, int ply)
+{
+  Game *game = &thread->Game;
+  Move *killers = thread->Killers[ply];
+  int (*history)[64] = thread->History[game->WhosTurn];
+  int i, see;
+  Move move;
+
+  for(i = 0; i < count; i++) {
+    move = moves[i];
+
+    if(move == transMove) {
+      scores[i] = TRANS_MOVE_SCORE;
+    } else if(isTactical(game, move)) {
+      see = See(game, move);
+      scores[i] = see >= 0 ? GOOD_CAPTURE_SCORE + see : BAD_CAPTURE_SCORE + see;
+    } else if(!historyOrdering) {
+      scores[i] = 0;
+    } else if(move == killers[0]) {
+      scores[i] = KILLER_SCORE + 1;
+    } else if(move == killers[1]) {
+      scores[i] = KILLER_SCORE;
+    } else {
+      scores[i] = history[FROM(move)][TO(move)];
+    }
+  }
+}
+
+// Search the root position to the specified depth. Returns false if the search was stopped
+// before completing, otherwise sets best and value. best is also searched first.
+static bool
+searchRoot(SearchThread *thread, Move *best, int *value, int depth)
+{
+  Game *game = &thread->Game;
+  int alpha = SMALL, count, extension, i, val;
+  int scores[INIT_MOVE_LEN];
+  Move move, bestMove = INVALID_MOVE;
+  Move buffer[INIT_MOVE_LEN];
+
+  thread->Nodes++;
+
+  count = AllMoves(buffer, game) - buffer;
+
+  if(count == 0) {
+    *best = INVALID_MOVE;
+    *value = Checked(game) ? -MATE : 0;
+    return true;
+  }
+
+  scoreMoves(thread, buffer, scores, count, *best, 0);
+
+  for(i = 0; i < count; i++) {
+    selectBest(buffer + i, scores + i, count - i);
+    move = buffer[i];
+    extension = GivesCheck(game, move) ? 1 : 0;
+
+    DoMove(game, move);
+    val = -alphaBeta(thread, SMALL, -alpha, depth - 1 + extension, 1);
+    Unmove(game);
+
+    // Any value obtained after the stop signal is unreliable.
+    if(stopSearch) {
+      return false;
+    }
+
+    if(val > alpha) {
+      alpha = val;
+      bestMove = move;
+    }
+  }
+
+  SavePosition(game->Hash, valueToTrans(alpha, 0), bestMove, depth, ExactBound);
+
+  *best = bestMove;
+  *value = alpha;
+
+  return true;
+}
+
+// Iteratively deepen the search, leaving each iteration's best move in the transposition table
+// for the next to search first. Helper threads search every other iteration 1 ply deeper than
+// the main thread, so they diverge from it and from each other.
+static void*
+searchThread(void *arg)
+{
+  SearchThread *thread = (SearchThread*)arg;
+  int depth, iterDepth, value;
+  Move best = thread->Best;
+
+  for(iterDepth = 1; iterDepth <= thread->MaxDepth; iterDepth++) {
+    depth = iterDepth;
+    if(thread->Id%2 == 1 && depth < thread->MaxDepth) {
+      depth++;
+    }
+
+    if(!searchRoot(thread, &best, &value, depth)) {
+      break;
+    }
+
+    thread->Best = best;
+    thread->CompletedDepth = depth;
+    thread->Value = value;
+
+    // No point searching any deeper if we've found a forced mate.
+    if(abs(value) >= MATE_BOUND) {
+      break;
+    }
+
+    if(thread->Id == 0) {
+      checkLimits();
+    }
+    if(stopIterating) {
+      break;
+    }
+  }
+
+  if(thread->Id == 0) {
+    stopSearch = true;
+  }
+
+  return NULL;
+}
+
+// Swap the move with the highest score to the start of the list.
+static FORCE_INLINE void
+selectBest(Move *moves, int *scores, int count)
+{
+  int i, best = 0, tmpScore;
+  Move tmpMove;
+
+  for(i = 1; i < count; i++) {
+    if(scores[i] > scores[best]) {
+      best = i;
+    }
+  }
+
+  tmpMove = moves[0];
+  moves[0] = moves[best];
+  moves[best] = tmpMove;
+
+  tmpScore = scores[0];
+  scores[0] = scores[best];
+  scores[best] = tmpScore;
+}
+
+// Remember a quiet move which caused a beta cutoff, so it's tried early in other positions at the
+// same ply and, via history, elsewhere in the tree. Deeper cutoffs count for more.
+static FORCE_INLINE void
+updateQuietStats(SearchThread *thread, Move move, int depth, int ply)
+{
+  int i;
+  int *entry = &thread->History[thread->Game.WhosTurn][FROM(move)][TO(move)];
+  int *history = &thread->History[0][0][0];
+  Move *killers = thread->Killers[ply];
+
+  if(killers[0] != move) {
+    killers[1] = killers[0];
+    killers[0] = move;
+  }
+
+  *entry += depth*depth;
+
+  // Halve every entry rather than let one reach the killer scores, which also lets recent
+  // cutoffs outweigh old ones.
+  if(*entry >= HISTORY_MAX) {
+    for(i = 0; i < 2*64*64; i++) {
+      history[i] /= 2;
+    }
+  }
+}
+
+// Mate scores are stored relative to the position rather than the root, so they remain correct
+// when the position is reached at a different ply.
+static FORCE_INLINE int
+valueFromTrans(int64_t value, int ply)
+{
+  if(value >= MATE_BOUND) {
+    return (int)value - ply;
+  }
+  if(value <= -MATE_BOUND) {
+    return (int)value + ply;
+  }
+
+  return (int)value;
+}
+
+static FORCE_INLINE int64_t
+valueToTrans(int value, int ply)
+{
+  if(value >= MATE_BOUND) {
+    return value + ply;
+  }
+  if(value <= -MATE_BOUND) {
+    return value - ply;
+  }
+
+  return value;
+}
+
+// Choose a move from those the threads found. Each thread votes for its move, weighted by the
+// depth it completed and how its score compares with the other threads'.
+static Move
+vote(SearchThread *threads, int count, int *value)
+{
+  int i, j, minValue = threads[0].Value, best = 0;
+  int64_t bestVotes = -1, votes;
+
+  for(i = 1; i < count; i++) {
+    if(threads[i].CompletedDepth > 0 && threads[i].Value < minValue) {
+      minValue = threads[i].Value;
+    }
+  }
+
+  for(i = 0; i < count; i++) {
+    if(threads[i].CompletedDepth == 0) {
+      continue;
+    }
+
+    votes = 0;
+    for(j = 0; j < count; j++) {
+      if(threads[j].CompletedDepth > 0 && threads[j].Best == threads[i].Best) {
+        votes += (int64_t)(threads[j].Value - minValue + 1)*threads[j].CompletedDepth;
+      }
+    }
+
+    if(votes > bestVotes) {
+      bestVotes = votes;
+      best = i;
+    }
+  }
+
+  *value = threads[best].Value;
+
+  return threads[best].Best;
+}
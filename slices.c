@@ -19,12 +19,45 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <string.h>
 #include "weak.h"
 
 static const int INIT_MEMORY_COUNT = 100;
 
 // TODO: Avoid duplication throughout.
 
+// Copy a memory slice into a newly allocated buffer, so the copy can be pushed and popped
+// independently of the original.
+MemorySlice
+CopyMemorySlice(MemorySlice *slice)
+{
+  MemorySlice ret;
+  long cap = slice->End - slice->Vals, count = slice->Curr - slice->Vals;
+
+  ret.Vals = (Memory*)allocate(sizeof(Memory), cap);
+  memcpy(ret.Vals, slice->Vals, sizeof(Memory)*count);
+  ret.Curr = ret.Vals + count;
+  ret.End = ret.Vals + cap;
+
+  return ret;
+}
+
+// Double the capacity of a full memory slice, so long games and deep searches from them don't
+// overrun it.
+void
+ExpandMemorySlice(MemorySlice *slice)
+{
+  long cap = slice->End - slice->Vals, count = slice->Curr - slice->Vals;
+  Memory *vals = (Memory*)allocate(sizeof(Memory), 2*cap);
+
+  memcpy(vals, slice->Vals, sizeof(Memory)*count);
+  release(slice->Vals);
+
+  slice->Vals = vals;
+  slice->Curr = vals + count;
+  slice->End = vals + 2*cap;
+}
+
 MemorySlice
 NewMemorySlice()
 {
@@ -32,6 +65,7 @@ NewMemorySlice()
 
   ret.Vals = (Memory*)allocate(sizeof(Memory), INIT_MEMORY_COUNT);
   ret.Curr = ret.Vals;
+  ret.End = ret.Vals + INIT_MEMORY_COUNT;
 
   return ret;
 }
@@ -47,3 +81,10 @@ NewMoveSlice(Move *buffer)
 
   return ret;
 }
+
+void
+ReleaseMemorySlice(MemorySlice *slice)
+{
+  release(slice->Vals);
+  slice->Vals = slice->Curr = slice->End = NULL;
+}
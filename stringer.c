@@ -24,6 +24,8 @@
 #include <ctype.h>
 #include "weak.h"
 
+static FORCE_INLINE int formatMoveSuffix(Move, char*);
+
 char
 CharPiece(Piece piece)
 {
@@ -45,6 +47,78 @@ CharPiece(Piece piece)
   }
 }
 
+// Format a move as from and to squares, e.g. e7e8=Q, into buffer, which must hold at least
+// FORMAT_MOVE_LEN characters. Returns the length, excluding the terminating null. Unlike
+// StringMove(), nothing is allocated, so this is suitable for printing many moves.
+int
+FormatMove(Move move, char *buffer)
+{
+  char *curr = buffer;
+
+  switch(TYPE(move)) {
+  case CastleKingSide:
+    memcpy(buffer, "O-O", 4);
+    return 3;
+  case CastleQueenSide:
+    memcpy(buffer, "O-O-O", 6);
+    return 5;
+  default:
+    break;
+  }
+
+  if(move == INVALID_MOVE) {
+    memcpy(buffer, "-", 2);
+    return 1;
+  }
+
+  curr += FormatPosition(FROM(move), curr);
+  curr += FormatPosition(TO(move), curr);
+  curr += formatMoveSuffix(move, curr);
+  *curr = '\0';
+
+  return curr - buffer;
+}
+
+// Format a move in long algebraic form, e.g. Nb1xc3, into buffer, which must hold at least
+// FORMAT_MOVE_FULL_LEN characters. Returns the length, excluding the terminating null.
+int
+FormatMoveFull(Move move, Piece piece, bool capture, char *buffer)
+{
+  char *curr = buffer;
+
+  if(move == INVALID_MOVE || TYPE(move)&CastleMask) {
+    return FormatMove(move, buffer);
+  }
+
+  if(piece != Pawn) {
+    *curr++ = CharPiece(piece);
+  }
+  curr += FormatPosition(FROM(move), curr);
+  *curr++ = capture ? 'x' : '-';
+  curr += FormatPosition(TO(move), curr);
+  curr += formatMoveSuffix(move, curr);
+  *curr = '\0';
+
+  return curr - buffer;
+}
+
+// Format a position, e.g. e4, into buffer, which must hold at least FORMAT_POSITION_LEN
+// characters. Returns the length, excluding the terminating null.
+int
+FormatPosition(Position pos, char *buffer)
+{
+  // Unsigned so we don't need to check < 0.
+  if(pos > 63) {
+    memcpy(buffer, "??", 3);
+  } else {
+    buffer[0] = 'a' + FILE(pos);
+    buffer[1] = '1' + RANK(pos);
+    buffer[2] = '\0';
+  }
+
+  return 2;
+}
+
 char*
 StringBitBoard(BitBoard bitBoard)
 {
@@ -224,102 +298,83 @@ StringChessSet(ChessSet *chessSet)
 }
 
 char*
-StringMove(Move move)
+StringCheckpointError(CheckpointError error)
 {
-  char ret[10];
-
-  if(move == INVALID_MOVE) {
-    return strdup("-");
-  }
-
-  sprintf(ret, "%s%s", StringPosition(FROM(move)),
-          StringPosition(TO(move)));
+  char *ret;
 
-  switch(TYPE(move)) {
-  case CastleKingSide:
-    return strdup("O-O");
-  case CastleQueenSide:
-    return strdup("O-O-O");
-  case PromoteKnight:
-    sprintf(ret+4, "=N");
-    break;
-  case PromoteBishop:
-    sprintf(ret+4, "=B");
-    break;
-  case PromoteRook:
-    sprintf(ret+4, "=R");
+  switch(error) {
+  case CheckpointOk:
+    ret = "no error";
     break;
-  case PromoteQueen:
-    sprintf(ret+4, "=Q");
+  case CheckpointMismatch:
+    ret = "it's for a different position, depth or build";
     break;
-  case EnPassant:
-    sprintf(ret+4, "ep");
-    break;
-  case Normal:
+  case CheckpointUnwritable:
+    ret = "unable to open it for writing";
     break;
   default:
-    sprintf(ret+4, "??%d", TYPE(move));
+    ret = "#invalid checkpoint error";
+    break;
   }
 
   return strdup(ret);
 }
 
-// String move in long algebraic form.
 char*
-StringMoveFull(Move move, Piece piece, bool capture)
+StringFenError(FenError error)
 {
-  char actionChr, pieceChr;
-  char *suffix, *from, *to;
-  char ret[1+2+1+2+2+1];
-
-  if(move == INVALID_MOVE) {
-    return strdup("-");
-  }
-
-  from = StringPosition(FROM(move));
-  to = StringPosition(TO(move));
+  char *ret;
 
-  switch(TYPE(move)) {
-  default:
-    suffix = "??";
+  switch(error) {
+  case FenOk:
+    ret = "no error";
     break;
-  case CastleQueenSide:
-    return strdup("O-O-O");
-  case CastleKingSide:
-    return strdup("O-O");
-  case EnPassant:
-    suffix = "ep";
+  case FenInvalidPlacement:
+    ret = "invalid piece placement";
     break;
-  case PromoteKnight:
-    suffix = "=N";
+  case FenInvalidSide:
+    ret = "invalid side to move";
     break;
-  case PromoteBishop:
-    suffix = "=B";
+  case FenInvalidCastling:
+    ret = "invalid castling rights";
     break;
-  case PromoteRook:
-    suffix = "=R";
+  case FenInvalidEnPassant:
+    ret = "invalid en passant square";
     break;
-  case PromoteQueen:
-    suffix = "=Q";
+  case FenInvalidClock:
+    ret = "invalid halfmove clock or fullmove number";
     break;
-  case Normal:
-    suffix = "";
+  case FenInvalidPosition:
+    ret = "illegal position";
+    break;
+  case FenTrailingCharacters:
+    ret = "unexpected trailing characters";
+    break;
+  default:
+    ret = "#invalid fen error";
     break;
   }
 
-  if(capture) {
-    actionChr = 'x';
-  } else {
-    actionChr = '-';
-  }
+  return strdup(ret);
+}
+
+char*
+StringMove(Move move)
+{
+  char ret[FORMAT_MOVE_LEN];
 
-  pieceChr = CharPiece(piece);
+  FormatMove(move, ret);
 
-  if(pieceChr == 'P' || pieceChr == 'p') {
-    sprintf(ret, "%s%c%s%s", from, actionChr, to, suffix);
-  } else {
-    sprintf(ret, "%c%s%c%s%s", pieceChr, from, actionChr, to, suffix);
-  }
+  return strdup(ret);
+}
+
+// String move in long algebraic form.
+char*
+StringMoveFull(Move move, Piece piece, bool capture)
+{
+  char ret[FORMAT_MOVE_FULL_LEN];
+
+  FormatMoveFull(move, piece, capture, ret);
 
   return strdup(ret);
 }
@@ -417,18 +472,14 @@ StringPiece(Piece piece)
 char*
 StringPosition(Position pos)
 {
-  char ret[2+1];
+  char ret[FORMAT_POSITION_LEN];
 
   // Unsigned so we don't need to check < 0.
   if(pos > 63) {
     return strdup("#invalid position");
   }
 
-  if(sprintf(ret, "%c%d", 'a'+FILE(pos), RANK(pos)+1) != 2) {
-    panic("Couldn't string position");
-  }
-
-  ret[2] = '\0';
+  FormatPosition(pos, ret);
 
   return strdup(ret);
 }
@@ -452,3 +503,116 @@ StringSide(Side side)
 
   return strdup(ret);
 }
+
+// Write the game's position as a FEN string, including both clocks, to buffer, which must hold
+// at least MAX_FEN_LEN characters. Returns the length of the string, excluding the terminating
+// null. The inverse of ParseFenInto().
+int
+WriteFen(Game *game, char *buffer)
+{
+  char *curr = buffer;
+  int empty, file, rank;
+  Piece piece;
+  Position pos;
+
+  for(rank = Rank8; rank >= Rank1; rank--) {
+    empty = 0;
+
+    for(file = FileA; file <= FileH; file++) {
+      pos = POSITION(rank, file);
+      piece = game->ChessSet.Squares[pos];
+
+      if(piece == MissingPiece) {
+        empty++;
+        continue;
+      }
+
+      if(empty > 0) {
+        *curr++ = '0' + empty;
+        empty = 0;
+      }
+
+      *curr = CharPiece(piece);
+      if(game->ChessSet.Sets[Black].Occupancy&POSBOARD(pos)) {
+        *curr = tolower(*curr);
+      }
+      curr++;
+    }
+
+    if(empty > 0) {
+      *curr++ = '0' + empty;
+    }
+    if(rank > Rank1) {
+      *curr++ = '/';
+    }
+  }
+
+  *curr++ = ' ';
+  *curr++ = game->WhosTurn == White ? 'w' : 'b';
+  *curr++ = ' ';
+
+  if(game->CastlingRights[White][KingSide]) {
+    *curr++ = 'K';
+  }
+  if(game->CastlingRights[White][QueenSide]) {
+    *curr++ = 'Q';
+  }
+  if(game->CastlingRights[Black][KingSide]) {
+    *curr++ = 'k';
+  }
+  if(game->CastlingRights[Black][QueenSide]) {
+    *curr++ = 'q';
+  }
+  if(curr[-1] == ' ') {
+    *curr++ = '-';
+  }
+
+  *curr++ = ' ';
+
+  if(game->EnPassantSquare == EmptyPosition) {
+    *curr++ = '-';
+  } else {
+    *curr++ = 'a' + FILE(game->EnPassantSquare);
+    *curr++ = '1' + RANK(game->EnPassantSquare);
+  }
+
+  curr += sprintf(curr, " %d %d", game->HalfMoveClock, game->FullMoveNumber);
+
+  return curr - buffer;
+}
+
+// Format the promotion or en passant suffix of a move. Returns the length, excluding the
+// terminating null.
+static FORCE_INLINE int
+formatMoveSuffix(Move move, char *buffer)
+{
+  char *suffix;
+
+  switch(TYPE(move)) {
+  case Normal:
+    *buffer = '\0';
+    return 0;
+  case EnPassant:
+    suffix = "ep";
+    break;
+  case PromoteKnight:
+    suffix = "=N";
+    break;
+  case PromoteBishop:
+    suffix = "=B";
+    break;
+  case PromoteRook:
+    suffix = "=R";
+    break;
+  case PromoteQueen:
+    suffix = "=Q";
+    break;
+  default:
+    suffix = "??";
+    break;
+  }
+
+  memcpy(buffer, suffix, 3);
+
+  return 2;
+}
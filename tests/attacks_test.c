@@ -0,0 +1,144 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "test.h"
+
+#define COUNT 5
+
+#if defined(QUICK_TEST)
+#define DEPTH 2
+#else
+#define DEPTH 3
+#endif
+
+static void checkPosition(Game*, StringBuilder*);
+static void checkTree(Game*, int, StringBuilder*);
+
+static char* fens[COUNT] = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -",
+  "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -",
+  "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+  "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1"
+};
+
+// Set-wise attack maps must agree with attacks calculated square by square, for both the
+// vectorised and scalar fills, over every position in the perft trees.
+char*
+TestAttacks()
+{
+  Game game;
+  int i;
+
+  StringBuilder builder = NewStringBuilder();
+
+  if(!InitSlidingAttacks(true)) {
+    printf("No AVX2, only testing the scalar fill.\n");
+  }
+
+  for(i = 0; i < COUNT; i++) {
+    game = ParseFen(fens[i]);
+    checkTree(&game, DEPTH, &builder);
+    ReleaseGame(&game);
+  }
+
+  return builder.Length == 0 ? NULL : BuildString(&builder, true);
+}
+
+static void
+checkPosition(Game *game, StringBuilder *builder)
+{
+  BitBoard actual, attacks, bishopish, occupancies[2], rookish, sliding;
+  ChessSet *chessSet = &game->ChessSet;
+  BitBoard *boards;
+  char fen[MAX_FEN_LEN];
+  int i;
+  Position from;
+  Side side;
+
+  for(side = White; side <= Black; side++) {
+    boards = chessSet->Sets[side].Boards;
+    bishopish = boards[Bishop] | boards[Queen];
+    rookish = boards[Rook] | boards[Queen];
+
+    // As for CheckStats threats, also with the defending king lifted off the board.
+    occupancies[0] = chessSet->Occupancy;
+    occupancies[1] = chessSet->Occupancy ^ chessSet->Sets[OPPOSITE(side)].Boards[King];
+
+    for(i = 0; i < 2; i++) {
+      sliding = EmptyBoard;
+      attacks = KingAttacksFrom(BitScanForward(boards[King]));
+      for(from = A1; from <= H8; from++) {
+        if(bishopish&POSBOARD(from)) {
+          sliding |= CalcBishopSquareThreats(from, occupancies[i]);
+        }
+        if(rookish&POSBOARD(from)) {
+          sliding |= CalcRookSquareThreats(from, occupancies[i]);
+        }
+        if(boards[Knight]&POSBOARD(from)) {
+          attacks |= KnightAttacksFrom(from);
+        }
+        if(boards[Pawn]&POSBOARD(from)) {
+          attacks |= PawnAttacksFrom(from, side);
+        }
+      }
+      attacks |= sliding;
+
+      InitSlidingAttacks(true);
+      actual = SlidingAttacks(rookish, bishopish, occupancies[i]);
+      if(actual != sliding || SlidingAttacksScalar(rookish, bishopish, occupancies[i]) != sliding) {
+        WriteFen(game, fen);
+        AppendString(builder, "Sliding attacks for %s in %s differ:-\n\n%s\n",
+                     StringSide(side), fen, StringBitBoard(actual ^ sliding));
+      }
+
+      // AllAttacksFrom() with the fill SlidingAttacks() uses without AVX2.
+      InitSlidingAttacks(false);
+      actual = AllAttacksFrom(chessSet, side, occupancies[i]);
+      InitSlidingAttacks(true);
+      if(actual != attacks || AllAttacksFrom(chessSet, side, occupancies[i]) != attacks) {
+        WriteFen(game, fen);
+        AppendString(builder, "All attacks for %s in %s differ.\n", StringSide(side), fen);
+      }
+    }
+  }
+}
+
+static void
+checkTree(Game *game, int depth, StringBuilder *builder)
+{
+  Move *curr, *end;
+  Move buffer[INIT_MOVE_LEN];
+
+  checkPosition(game, builder);
+
+  if(depth == 0) {
+    return;
+  }
+
+  end = AllMoves(buffer, game);
+
+  for(curr = buffer; curr < end; curr++) {
+    DoMove(game, *curr);
+    checkTree(game, depth - 1, builder);
+    Unmove(game);
+  }
+}
@@ -0,0 +1,81 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "test.h"
+
+#define COUNT 5
+
+// Each position is reached via a quiet move so CheckStats are stale when the checking move is
+// made, as they are in search.
+static char* fens[COUNT] = {
+  "4k3/7p/8/8/4N3/8/8/4RK2 b - -",
+  "4k3/7p/8/8/4B3/8/8/4RK2 b - -",
+  "7k/p7/8/8/3R4/8/1B6/K7 b - -",
+  "4k3/7p/8/8/8/8/8/R3K3 b - -",
+  "4K3/8/8/8/4n3/8/7P/4r2k w - -"
+};
+
+static char* moves[COUNT][2] = {
+  { "h7h6", "e4d6" },
+  { "h7h6", "e4c2" },
+  { "a7a6", "d4d8" },
+  { "h7h6", "a1a8" },
+  { "h2h3", "e4d6" }
+};
+
+// Number of pieces giving check after the moves - double checks combine a direct check with a
+// discovered one.
+static int expected[COUNT] = { 2, 1, 2, 1, 2 };
+
+// Test that DoMove determines every source of check, including discovered checks.
+char*
+TestChecks()
+{
+  BitBoard actual, checks;
+  Game game;
+  int i;
+  Side side;
+
+  StringBuilder builder = NewStringBuilder();
+
+  for(i = 0; i < COUNT; i++) {
+    game = ParseFen(fens[i]);
+    DoMove(&game, ParseMove(moves[i][0]));
+    side = game.WhosTurn;
+    DoMove(&game, ParseMove(moves[i][1]));
+
+    actual = game.CheckStats.CheckSources;
+    checks = AllAttackersTo(&game.ChessSet, game.CheckStats.DefendedKing,
+                            game.ChessSet.Occupancy) & game.ChessSet.Sets[side].Occupancy;
+
+    if(actual != checks || PopCount(actual) != expected[i]) {
+      AppendString(&builder, "%s in %s gives %d checks, expected %d.\n", moves[i][1], fens[i],
+                   PopCount(actual), expected[i]);
+    }
+  }
+
+  if(builder.Length == 0) {
+    ReleaseStringBuilder(&builder);
+    return NULL;
+  }
+
+  return BuildString(&builder, true);
+}
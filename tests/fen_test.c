@@ -0,0 +1,105 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "test.h"
+
+#define ROUND_TRIP_COUNT 6
+#define INVALID_COUNT    12
+
+static char* roundTripFens[ROUND_TRIP_COUNT] = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+  "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 12 40",
+  "rnbqkbnr/ppp1pppp/8/3pP3/8/8/PPPP1PPP/RNBQKBNR w Kq d6 0 3",
+  "rnbqkbnr/pppp1ppp/8/8/3Pp3/8/PPP1PPPP/RNBQKBNR b KQkq d3 0 3",
+  "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 99 1000"
+};
+
+static char* invalidFens[INVALID_COUNT] = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP w KQkq - 0 1",
+  "rnbqkbnr/pppppppp/9/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "rnbqkbnr/ppppxppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR x KQkq - 0 1",
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBN1 w KQkq - 0 1",
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq e3 0 1",
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - x 1",
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 x",
+  "rnbqqbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNP w Qkq - 0 1",
+  "4k2R/8/8/8/8/8/8/4K3 w - - 0 1",
+  ""
+};
+
+static FenError expectedErrors[INVALID_COUNT] = {
+  FenInvalidPlacement, FenInvalidPlacement, FenInvalidPlacement, FenInvalidSide,
+  FenInvalidCastling, FenInvalidEnPassant, FenInvalidClock, FenTrailingCharacters,
+  FenInvalidPosition, FenInvalidPosition, FenInvalidPosition, FenInvalidPlacement
+};
+
+// Test that FENs survive a round trip through ParseFenInto() and WriteFen(), that the hash and
+// score match those calculated from scratch, and that invalid FENs are rejected.
+char*
+TestFen()
+{
+  char buffer[MAX_FEN_LEN];
+  FenError error;
+  Game game = NewEmptyGame(false, White);
+  int i, len;
+  StringBuilder builder = NewStringBuilder();
+
+  for(i = 0; i < ROUND_TRIP_COUNT; i++) {
+    error = ParseFenInto(&game, roundTripFens[i], strlen(roundTripFens[i]));
+    if(error != FenOk) {
+      AppendString(&builder, "Couldn't parse %s - %s.\n", roundTripFens[i],
+                   StringFenError(error));
+      continue;
+    }
+
+    len = WriteFen(&game, buffer);
+    if(len != (int)strlen(buffer) || strcmp(buffer, roundTripFens[i]) != 0) {
+      AppendString(&builder, "Wrote %s, expected %s.\n", buffer, roundTripFens[i]);
+    }
+
+    if(game.Hash != HashGame(&game) || game.Score != ScoreGame(&game)) {
+      AppendString(&builder, "Incorrect hash or score for %s.\n", roundTripFens[i]);
+    }
+  }
+
+  // Omitted clocks take their defaults.
+  ParseFenInto(&game, "4k3/8/8/8/8/8/8/4K3 b - -", 25);
+  WriteFen(&game, buffer);
+  if(strcmp(buffer, "4k3/8/8/8/8/8/8/4K3 b - - 0 1") != 0) {
+    AppendString(&builder, "Wrote %s with clocks omitted.\n", buffer);
+  }
+
+  for(i = 0; i < INVALID_COUNT; i++) {
+    error = ParseFenInto(&game, invalidFens[i], strlen(invalidFens[i]));
+    if(error != expectedErrors[i]) {
+      AppendString(&builder, "Parsing '%s' gave '%s', expected '%s'.\n", invalidFens[i],
+                   StringFenError(error), StringFenError(expectedErrors[i]));
+    }
+  }
+
+  ReleaseGame(&game);
+
+  return builder.Length == 0 ? NULL : BuildString(&builder, true);
+}
@@ -0,0 +1,90 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "test.h"
+
+#define COUNT 3
+
+// A node limited search may overshoot by however many nodes are searched between the monitor's
+// checks, which are made every millisecond.
+#define NODE_LIMIT       100000
+#define NODE_LIMIT_SLACK 50000
+
+static char* fens[COUNT] = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -",
+  "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -"
+};
+
+// Test that a node limited search stops near its budget and still returns a legal move.
+char*
+TestSearchLimits()
+{
+  bool legal;
+  Game game;
+  int i, value;
+  Move best;
+  Move buffer[INIT_MOVE_LEN];
+  Move *curr, *end;
+  SearchLimits limits;
+  uint64_t nodes;
+
+  StringBuilder builder = NewStringBuilder();
+
+  limits.Depth = 0;
+  limits.Nodes = NODE_LIMIT;
+  limits.Millis = 0;
+
+  for(i = 0; i < COUNT; i++) {
+    game = ParseFen(fens[i]);
+    nodes = 0;
+
+    ClearTrans();
+    best = SearchLimited(&game, &limits, &nodes, &value, 1);
+
+  if(nodes < NODE_LIMIT || nodes > NODE_LIMIT + NODE_LIMIT_SLACK) {
+      AppendString(&builder, "Search limited to %d nodes searched %lu for %s.\n", NODE_LIMIT,
+                   nodes, fens[i]);
+    }
+
+    legal = false;
+    end = AllMoves(buffer, &game);
+    for(curr = buffer; curr < end; curr++) {
+      if(*curr == best) {
+        legal = true;
+      }
+    }
+
+    if(!legal) {
+      AppendString(&builder, "Search limited to %d nodes returned an illegal move for %s.\n",
+                   NODE_LIMIT, fens[i]);
+    }
+
+    ReleaseGame(&game);
+  }
+
+  if(builder.Length == 0) {
+    ReleaseStringBuilder(&builder);
+    return NULL;
+  }
+
+  return BuildString(&builder, true);
+}
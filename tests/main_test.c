@@ -21,17 +21,41 @@
 
 #include "test.h"
 
-#define TEST_COUNT 3
+#define TEST_COUNT 15
 
 static char* (*testFunctions[TEST_COUNT])(void) = {
   &TestPerft,
+  &TestChecks,
+  &TestHashPerft,
+  &TestParallelPerft,
+  &TestCheckpointPerft,
+  &TestDistributedPerft,
+  &TestUniquePerft,
+  &TestCountMovesBatch,
+  &TestAttacks,
   &TestMatesInOne,
-  &TestMatesInTwo
+  &TestMatesInTwo,
+  &TestSearchLimits,
+  &TestSee,
+  &TestRepetition,
+  &TestFen
 };
 static char *testNames[TEST_COUNT] = {
   "Perft Test",
+  "Check Test",
+  "Hash Perft Test",
+  "Parallel Perft Test",
+  "Checkpoint Perft Test",
+  "Distributed Perft Test",
+  "Unique Perft Test",
+  "Batched Move Count Test",
+  "Attacks Test",
   "Mates in One Test",
-  "Mates in Two Test"
+  "Mates in Two Test",
+  "Search Limits Test",
+  "SEE Test",
+  "Repetition Test",
+  "FEN Test"
 };
 
 int main()
@@ -19,14 +19,26 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <string.h>
+#include <unistd.h>
 #include "test.h"
 
 #if defined(QUICK_TEST)
 #define MAX_DEPTH 4
+#define MAX_PARALLEL_DEPTH 4
 #else
 #define MAX_DEPTH 7
+#define MAX_PARALLEL_DEPTH 5
 #endif
 
+// CountMovesBatch() is checked over the whole frontier one ply short of this depth.
+#define MAX_BATCH_DEPTH 4
+// Includes counts which don't divide the work evenly.
+#define PARALLEL_MAX_THREADS 3
+// Search and hashed perft are interleaved at this depth to check they don't confuse each other's
+// transposition entries.
+#define SHARED_TRANS_DEPTH 3
+
 #define PERFT_COUNT 5
 
 #define FEN1 "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
@@ -36,6 +48,7 @@
 #define FEN4_REVERSED "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1"
 
 static void printError(char*);
+static void truncateCheckpoint(char*);
 
 static char *fens[PERFT_COUNT] = { FEN1, FEN2, FEN3, FEN4, FEN4_REVERSED };
 
@@ -178,9 +191,399 @@ TestPerft()
   return builder.Length == 1 ? NULL : BuildString(&builder, true);
 }
 
+// Checkpointed perft must agree with the plain node counts, both from scratch and when resumed
+// from a checkpoint cut short mid-line, and must refuse a checkpoint for a different depth.
+char*
+TestCheckpointPerft()
+{
+  char path[] = "/tmp/weak_checkpoint_XXXXXX";
+  char tmp[200], total[UINT128_DECIMAL_LEN];
+  Game game;
+  int fd, i, j, resume;
+  uint64_t expected;
+  Uint128 actual;
+
+  StringBuilder builder = NewStringBuilder();
+
+  // 2^64 + 5 needs the high word.
+  actual.Hi = 0;
+  actual.Lo = UINT64_MAX;
+  AddUint128(&actual, 6);
+  FormatUint128(actual, total);
+  if(strcmp(total, "18446744073709551621") != 0) {
+    sprintf(tmp, "Expected 2^64 + 5 to format as 18446744073709551621, got %s.\n", total);
+    printError(tmp);
+    AppendString(&builder, tmp);
+  }
+
+  if((fd = mkstemp(path)) < 0) {
+    return strdup("Unable to create checkpoint file.");
+  }
+  close(fd);
+
+  for(i = 0; i < PERFT_COUNT; i++) {
+    game = ParseFen(fens[i]);
+
+    for(j = 3; j <= expectedDepthCounts[i] && j <= MAX_DEPTH; j++) {
+      expected = expecteds[i][j-1].Count;
+      remove(path);
+
+      for(resume = 0; resume <= 1; resume++) {
+        if(resume) {
+          truncateCheckpoint(path);
+        }
+
+        if(!CheckpointPerft(&game, j, 2, false, path, &actual, NULL) || actual.Hi != 0 ||
+           actual.Lo != expected) {
+          sprintf(tmp, "Checkpoint Perft Position %d Depth %d%s: Expected %lu nodes, got "
+                  "%lu.\n", i+1, j, resume ? " (resumed)" : "", expected, actual.Lo);
+          printError(tmp);
+          AppendString(&builder, tmp);
+        }
+      }
+
+      if(CheckpointPerft(&game, j + 1, 1, false, path, &actual, NULL)) {
+        sprintf(tmp, "Checkpoint Perft Position %d Depth %d: Used a depth %d checkpoint.\n",
+                i+1, j + 1, j);
+        printError(tmp);
+        AppendString(&builder, tmp);
+      }
+    }
+
+    ReleaseGame(&game);
+  }
+
+  remove(path);
+
+  return builder.Length == 0 ? NULL : BuildString(&builder, true);
+}
+
+// The batched move counts of every position one ply short of each depth, weighted by how many
+// ways each is reached, must add up to the perft count, with either kernel and whatever the
+// batch size.
+char*
+TestCountMovesBatch()
+{
+  char fen[MAX_FEN_LEN], tmp[200];
+  Frontier frontier;
+  Game game;
+  Game *games;
+  Game **pointers;
+  int batch, i, j, k, ply, vectorise;
+  uint32_t *counts;
+  uint64_t actual, expected;
+
+  StringBuilder builder = NewStringBuilder();
+
+  for(i = 0; i < PERFT_COUNT; i++) {
+    game = ParseFen(fens[i]);
+
+    for(j = 1; j <= expectedDepthCounts[i] && j <= MAX_BATCH_DEPTH; j++) {
+      expected = expecteds[i][j-1].Count;
+
+      frontier = CollectFrontier(&game, j - 1);
+      games = (Game*)allocate(sizeof(Game), frontier.Count);
+      pointers = (Game**)allocate(sizeof(Game*), frontier.Count);
+      counts = (uint32_t*)allocate(sizeof(uint32_t), frontier.Count);
+
+      for(k = 0; k < frontier.Count; k++) {
+        PlayFrontierEntry(&game, &frontier, k);
+        WriteFen(&game, fen);
+        games[k] = ParseFen(fen);
+        pointers[k] = &games[k];
+        for(ply = 0; ply < frontier.Depth; ply++) {
+          Unmove(&game);
+        }
+      }
+
+      for(vectorise = 0; vectorise <= 1; vectorise++) {
+        InitCountMovesBatch(vectorise);
+
+        for(batch = 1; batch <= 5; batch++) {
+          for(k = 0; k < frontier.Count; k += batch) {
+            CountMovesBatch(pointers + k, frontier.Count - k < batch ? frontier.Count - k : batch,
+                            counts + k);
+          }
+
+          actual = 0;
+          for(k = 0; k < frontier.Count; k++) {
+            actual += counts[k]*frontier.Entries[k].Multiplicity;
+          }
+
+          if(actual != expected) {
+            sprintf(tmp, "Batched Move Count Position %d Depth %d, batches of %d%s: Expected "
+                    "%lu nodes, got %lu.\n", i+1, j, batch, vectorise ? " (vectorised)" : "",
+                    expected, actual);
+            printError(tmp);
+            AppendString(&builder, tmp);
+          }
+        }
+      }
+
+      for(k = 0; k < frontier.Count; k++) {
+        ReleaseGame(&games[k]);
+      }
+      release(games);
+      release(pointers);
+      release(counts);
+      ReleaseFrontier(&frontier);
+    }
+
+    ReleaseGame(&game);
+  }
+
+  InitCountMovesBatch(true);
+
+  return builder.Length == 0 ? NULL : BuildString(&builder, true);
+}
+
+// Distributed perft over local worker processes must agree with the plain node counts at each
+// split depth, and its frontier must contain every position at that depth.
+char*
+TestDistributedPerft()
+{
+  char tmp[200];
+  Frontier frontier;
+  Game game;
+  int i, j, split;
+  uint64_t expected;
+  Uint128 actual;
+
+  StringBuilder builder = NewStringBuilder();
+
+  // (2^64 - 1)^2 = 2^128 - 2^65 + 1.
+  actual.Hi = 0;
+  actual.Lo = 0;
+  AddProductUint128(&actual, UINT64_MAX, UINT64_MAX);
+  if(actual.Hi != UINT64_MAX - 1 || actual.Lo != 1) {
+    sprintf(tmp, "Expected (2^64 - 1)^2 to be %lx:1, got %lx:%lx.\n", UINT64_MAX - 1, actual.Hi,
+            actual.Lo);
+    printError(tmp);
+    AppendString(&builder, tmp);
+  }
+
+  for(i = 0; i < PERFT_COUNT; i++) {
+    game = ParseFen(fens[i]);
+
+    for(split = 1; split <= 2; split++) {
+      frontier = CollectFrontier(&game, split);
+      expected = expecteds[i][split-1].Count;
+      if(frontier.Positions != expected || frontier.Count < 1 ||
+         (uint64_t)frontier.Count > expected) {
+        sprintf(tmp, "Frontier Position %d Depth %d: Expected %lu positions, got %lu with %d "
+                "unique.\n", i+1, split, expected, frontier.Positions, frontier.Count);
+        printError(tmp);
+        AppendString(&builder, tmp);
+      }
+      ReleaseFrontier(&frontier);
+
+      for(j = split + 1; j <= expectedDepthCounts[i] && j <= MAX_DEPTH; j++) {
+        expected = expecteds[i][j-1].Count;
+
+        if(!DistributedPerft(&game, j, split, 3, NULL, false, &actual, NULL) || actual.Hi != 0 ||
+           actual.Lo != expected) {
+          sprintf(tmp, "Distributed Perft Position %d Depth %d, split %d: Expected %lu nodes, "
+                  "got %lu.\n", i+1, j, split, expected, actual.Lo);
+          printError(tmp);
+          AppendString(&builder, tmp);
+        }
+      }
+    }
+
+    ReleaseGame(&game);
+  }
+
+  return builder.Length == 0 ? NULL : BuildString(&builder, true);
+}
+
+// Hashed perft must agree with the plain node counts, with or without prefetching, and neither it
+// nor search may use the other's transposition entries.
+char*
+TestHashPerft()
+{
+  char tmp[200];
+  Game game;
+  int i, j, prefetch, sharedValue, value;
+  uint64_t actual, expected, nodes;
+
+  StringBuilder builder = NewStringBuilder();
+
+  ClearTrans();
+
+  for(i = 0; i < PERFT_COUNT; i++) {
+    game = ParseFen(fens[i]);
+
+    for(j = 1; j <= expectedDepthCounts[i] && j <= MAX_DEPTH; j++) {
+      expected = expecteds[i][j-1].Count;
+
+      for(prefetch = 0; prefetch <= 1; prefetch++) {
+        actual = HashPerft(&game, j, prefetch);
+
+        if(actual != expected) {
+          sprintf(tmp, "Hash Perft Position %d Depth %d%s: Expected %lu nodes, got %lu.\n",
+                  i+1, j, prefetch ? " (prefetch)" : "", expected, actual);
+          printError(tmp);
+          AppendString(&builder, tmp);
+        }
+      }
+    }
+  }
+
+  for(i = 0; i < PERFT_COUNT; i++) {
+    game = ParseFen(fens[i]);
+
+    ClearTrans();
+    Search(&game, &nodes, &value, SHARED_TRANS_DEPTH);
+
+    for(j = 2; j <= SHARED_TRANS_DEPTH; j++) {
+      expected = expecteds[i][j-1].Count;
+      actual = HashPerft(&game, j, false);
+
+      if(actual != expected) {
+        sprintf(tmp, "Hash Perft Position %d Depth %d after search: Expected %lu nodes, got "
+                "%lu.\n", i+1, j, expected, actual);
+        printError(tmp);
+        AppendString(&builder, tmp);
+      }
+    }
+
+    ClearTrans();
+    HashPerft(&game, SHARED_TRANS_DEPTH, false);
+    Search(&game, &nodes, &sharedValue, SHARED_TRANS_DEPTH);
+
+    if(sharedValue != value) {
+      sprintf(tmp, "Search Position %d Depth %d after hash perft: Expected value %d, got %d.\n",
+              i+1, SHARED_TRANS_DEPTH, value, sharedValue);
+      printError(tmp);
+      AppendString(&builder, tmp);
+    }
+  }
+
+  return builder.Length == 0 ? NULL : BuildString(&builder, true);
+}
+
+// Parallel perft must agree with the plain node counts whatever the thread count, and the nodes
+// counted by each thread must add up to the total.
+char*
+TestParallelPerft()
+{
+  char tmp[200];
+  Game game;
+  int hash, i, j, k, threads;
+  uint64_t actual, expected, sum;
+  uint64_t threadNodes[PARALLEL_MAX_THREADS];
+
+  StringBuilder builder = NewStringBuilder();
+
+  for(i = 0; i < PERFT_COUNT; i++) {
+    game = ParseFen(fens[i]);
+
+    for(j = 1; j <= expectedDepthCounts[i] && j <= MAX_PARALLEL_DEPTH; j++) {
+      expected = expecteds[i][j-1].Count;
+
+      for(threads = 1; threads <= PARALLEL_MAX_THREADS; threads++) {
+        for(hash = 0; hash <= 1; hash++) {
+          ClearTrans();
+          actual = ParallelPerft(&game, j, threads, hash, threadNodes);
+
+          sum = 0;
+          for(k = 0; k < threads; k++) {
+            sum += threadNodes[k];
+          }
+
+          if(actual != expected || sum != expected) {
+            sprintf(tmp, "Parallel Perft Position %d Depth %d, %d threads%s: Expected %lu "
+                    "nodes, got %lu (%lu over threads).\n", i+1, j, threads,
+                    hash ? " (hash)" : "", expected, actual, sum);
+            printError(tmp);
+            AppendString(&builder, tmp);
+          }
+        }
+      }
+    }
+
+    ReleaseGame(&game);
+  }
+
+  return builder.Length == 0 ? NULL : BuildString(&builder, true);
+}
+
+// Unique perft must agree with the plain node counts whichever depth it splits at.
+char*
+TestUniquePerft()
+{
+  char tmp[200];
+  Game game;
+  int hash, i, j, split, threads;
+  uint64_t expected;
+  Uint128 actual;
+
+  StringBuilder builder = NewStringBuilder();
+
+  for(i = 0; i < PERFT_COUNT; i++) {
+    game = ParseFen(fens[i]);
+
+    for(j = 1; j <= expectedDepthCounts[i] && j <= MAX_PARALLEL_DEPTH; j++) {
+      expected = expecteds[i][j-1].Count;
+
+      for(split = 1; split <= 3; split++) {
+        for(threads = 1; threads <= PARALLEL_MAX_THREADS; threads++) {
+          for(hash = 0; hash <= 1; hash++) {
+            ClearTrans();
+            UniquePerft(&game, j, split, threads, hash, &actual, NULL);
+
+            if(actual.Hi != 0 || actual.Lo != expected) {
+              sprintf(tmp, "Unique Perft Position %d Depth %d, split %d, %d threads%s: "
+                      "Expected %lu nodes, got %lu.\n", i+1, j, split, threads,
+                      hash ? " (hash)" : "", expected, actual.Lo);
+              printError(tmp);
+              AppendString(&builder, tmp);
+            }
+          }
+        }
+      }
+    }
+
+    ReleaseGame(&game);
+  }
+
+  return builder.Length == 0 ? NULL : BuildString(&builder, true);
+}
+
 static void
 printError(char *error)
 {
   // Errors already include a newline.
   printf("ERROR:  %s", error);
 }
+
+// Keep the header and the first half of the subtree lines of a checkpoint, then cut the next line
+// short as if we crashed while writing it.
+static void
+truncateCheckpoint(char *path)
+{
+  char line[200];
+  char *kept;
+  FILE *file = fopen(path, "r");
+  int count = 0, i;
+  StringBuilder builder = NewStringBuilder();
+
+  while(fgets(line, sizeof(line), file) != NULL) {
+    count++;
+  }
+  rewind(file);
+
+  // 3 lines of header.
+  for(i = 0; i < 3 + (count - 3)/2 && fgets(line, sizeof(line), file) != NULL; i++) {
+    AppendString(&builder, "%s", line);
+  }
+  fclose(file);
+  kept = BuildString(&builder, true);
+
+  file = fopen(path, "w");
+  fputs(kept, file);
+  fputs("12 3", file);
+  fclose(file);
+
+  release(kept);
+}
@@ -0,0 +1,80 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "test.h"
+
+#define SHUFFLE_COUNT 8
+
+// Both knights out and back twice. From the 4th ply on, every position has occurred before.
+static char* shuffle[SHUFFLE_COUNT] = {
+  "g1f3", "g8f6", "f3g1", "f6g8", "g1f3", "g8f6", "f3g1", "f6g8"
+};
+
+// Test repetition detection, the halfmove clock and the fifty move rule.
+char*
+TestRepetition()
+{
+  Game game;
+  int i;
+  StringBuilder builder = NewStringBuilder();
+
+  game = NewGame(false, White);
+  for(i = 0; i < SHUFFLE_COUNT; i++) {
+    DoMove(&game, ParseMove(shuffle[i]));
+
+    if(Repeated(&game) != (i >= 3)) {
+      AppendString(&builder, "Repetition %sdetected after %d plies.\n",
+                   Repeated(&game) ? "" : "not ", i+1);
+    }
+    if(game.HalfMoveClock != i+1) {
+      AppendString(&builder, "Halfmove clock is %d after %d quiet plies.\n", game.HalfMoveClock,
+                   i+1);
+    }
+  }
+
+  // A pawn move resets the clock, and no earlier position can then recur.
+  DoMove(&game, ParseMove("e2e4"));
+  if(game.HalfMoveClock != 0) {
+    AppendString(&builder, "Halfmove clock is %d after a pawn move.\n", game.HalfMoveClock);
+  }
+  Unmove(&game);
+  if(game.HalfMoveClock != SHUFFLE_COUNT || !Repeated(&game)) {
+    AppendString(&builder, "Unmove didn't restore the halfmove clock.\n");
+  }
+
+  game = ParseFen("4k3/8/8/8/8/8/8/R3K3 w - - 99 80");
+  if(game.HalfMoveClock != 99 || FiftyMoveDraw(&game)) {
+    AppendString(&builder, "Parsed halfmove clock %d, expected 99.\n", game.HalfMoveClock);
+  }
+  DoMove(&game, ParseMove("a1a2"));
+  if(!FiftyMoveDraw(&game)) {
+    AppendString(&builder, "Fifty move rule not applied.\n");
+  }
+
+  // Checkmate takes precedence.
+  game = ParseFen("4k3/8/4K3/8/8/8/8/R7 w - - 99 80");
+  DoMove(&game, ParseMove("a1a8"));
+  if(FiftyMoveDraw(&game)) {
+    AppendString(&builder, "Fifty move rule applied to checkmate.\n");
+  }
+
+  return builder.Length == 0 ? NULL : BuildString(&builder, true);
+}
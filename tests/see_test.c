@@ -0,0 +1,58 @@
+/*
+  Weak, a chess perft calculator derived from Stockfish.
+
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish authors)
+  Copyright (C) 2011-2012 Lorenzo Stoakes
+
+  Weak is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Weak is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "test.h"
+
+#define COUNT 5
+
+static char* fens[COUNT] = {
+  "1k1r4/1pp4p/p7/4p3/8/P5P1/1PP4P/2K1R3 w - -",
+  "1k1r3q/1ppn3p/p4b2/4p3/8/P2N2P1/1PP1R1BP/2K1Q3 w - -",
+  "4k3/8/3p4/4p3/8/8/8/4Q2K w - -",
+  "4rk2/8/8/8/8/8/8/4R1K1 w - -",
+  "4rk2/8/8/8/8/8/4R3/4R1K1 w - -"
+};
+
+static char* moves[COUNT] = { "e1e5", "d3e5", "e1e5", "e1e8", "e2e8" };
+
+static int expected[COUNT] = { 100, -200, -800, 0, 500 };
+
+// Test static exchange evaluation, including x-ray attackers and king recaptures.
+char*
+TestSee()
+{
+  Game game;
+  int actual, i;
+
+  StringBuilder builder = NewStringBuilder();
+
+  for(i = 0; i < COUNT; i++) {
+    game = ParseFen(fens[i]);
+    actual = See(&game, ParseMove(moves[i]));
+
+    if(actual != expected[i]) {
+      AppendString(&builder, "SEE of %s in %s is %d, expected %d.\n", moves[i], fens[i],
+                   actual, expected[i]);
+    }
+  }
+
+  return builder.Length == 0 ? NULL : BuildString(&builder, true);
+}
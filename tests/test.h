@@ -26,8 +26,23 @@
 
 #include "../weak.h"
 
+// attacks_test.c
+char* TestAttacks(void);
+
+// fen_test.c
+char* TestFen(void);
+
+// check_test.c
+char* TestChecks(void);
+
 // perft_test.c
+char* TestCheckpointPerft(void);
+char* TestCountMovesBatch(void);
+char* TestDistributedPerft(void);
+char* TestHashPerft(void);
+char* TestParallelPerft(void);
 char* TestPerft(void);
+char* TestUniquePerft(void);
 
 // mateInOne_test.c
 char* TestMatesInOne(void);
@@ -35,4 +50,13 @@ char* TestMatesInOne(void);
 // mateInTwo_test.c
 char* TestMatesInTwo(void);
 
+// limits_test.c
+char* TestSearchLimits(void);
+
+// repetition_test.c
+char* TestRepetition(void);
+
+// see_test.c
+char* TestSee(void);
+
 #endif
@@ -20,13 +20,32 @@
 */
 
 #include <pthread.h>
+#include <unistd.h>
 
 #include "weak.h"
 
 #ifdef USE_THREAD
+// Number of processors currently online, at least 1.
+int
+CpuCount()
+{
+  long ret = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return ret < 1 ? 1 : (int)ret;
+}
+
+// Atomically add n to *value, returning its previous value.
+int
+FetchAdd(volatile int *value, int n)
+{
+  return __sync_fetch_and_add(value, n);
+}
+
+// Start a detached thread. Returns false if the thread could not be started.
 bool
 CreateThread(void *(*thread)(void*), void *arg)
 {
+  bool ret;
   pthread_attr_t attr;
   pthread_t      posixThreadId;
 
@@ -34,10 +53,36 @@ CreateThread(void *(*thread)(void*), void *arg)
     return false;
   }
 
-  if(pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED)) {
-    return false;
+  ret = !pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) &&
+    !pthread_create(&posixThreadId, &attr, thread, arg);
+
+  pthread_attr_destroy(&attr);
+
+  return ret;
+}
+
+// Run count instances of thread concurrently and wait for them all to finish. The ith instance is
+// passed args + i*size, so args is typically an array of per-thread structures.
+bool
+RunThreads(int count, void *(*thread)(void*), void *args, size_t size)
+{
+  bool ret = true;
+  int i, started;
+  pthread_t *threads = allocate(sizeof(pthread_t), count);
+
+  for(started = 0; started < count; started++) {
+    if(pthread_create(&threads[started], NULL, thread, (char*)args + started*size)) {
+      ret = false;
+      break;
+    }
+  }
+
+  for(i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
   }
 
-  return !!pthread_create(&posixThreadId, &attr, thread, arg);
+  release(threads);
+
+  return ret;
 }
 #endif
@@ -21,74 +21,174 @@
 
 // Derived from Stockfish transposition table.
 
+#include <string.h>
 #include "weak.h"
 
-// TODO: Parameterise.
 #define DEFAULT_SIZE_MB 128
 
-//static uint8_t       generation = 0;
-static TransCluster* clusters   = NULL;
-static uint64_t      transSize  = 0;
-static uint8_t       generation = 0;
+// Minimum number of clusters, and the number of clusters sampled to determine hashfull.
+#define MIN_CLUSTERS      1024
+#define HASHFULL_CLUSTERS 1000
+
+// Below this size it isn't worth starting threads to clear the table.
+#define MIN_PARALLEL_CLEAR_MB 64
+
+typedef struct ClearSlice ClearSlice;
 
+struct ClearSlice {
+  TransCluster *Start;
+  uint64_t      Count;
+};
+
+//static uint8_t       generation = 0;
+static TransCluster* clusters       = NULL;
+static uint64_t      transSize      = 0;
+static uint8_t       generation     = 0;
+static bool          hugePages      = true;
+static bool          clustersHuge   = false;
+static size_t        clustersLength = 0;
+
+static void*        clearSlice(void*);
+static FORCE_INLINE uint32_t entryCheck(TransEntry*);
 static FORCE_INLINE TransEntry* firstEntry(uint64_t);
-static void         saveEntry(TransEntry*, uint16_t, uint8_t, uint32_t, QuickMove, int);
+static void         saveEntry(TransEntry*, uint8_t, uint8_t, uint32_t, QuickMove, int64_t);
+
+// Zero the table. Large tables are cleared by all processors at once - this is also the first
+// touch of freshly allocated pages, so page faults are shared between threads too.
+void
+ClearTrans()
+{
+  uint64_t bytes = transSize*sizeof(TransCluster);
+#ifdef USE_THREAD
+  ClearSlice *slices;
+  int i, threads = CpuCount();
+  uint64_t offset, perThread;
+
+  if(threads > 1 && bytes >= MIN_PARALLEL_CLEAR_MB*C64(1024)*C64(1024)) {
+    slices = allocate(sizeof(ClearSlice), threads);
+    perThread = transSize/threads;
+
+    for(i = 0, offset = 0; i < threads; i++, offset += perThread) {
+      slices[i].Start = clusters + offset;
+      // The last thread picks up the remainder.
+      slices[i].Count = i == threads - 1 ? transSize - offset : perThread;
+    }
+
+    if(RunThreads(threads, clearSlice, slices, sizeof(ClearSlice))) {
+      release(slices);
+      return;
+    }
 
+    // If we couldn't start every thread, just do it all ourselves.
+    release(slices);
+  }
+#endif
+
+  memset(clusters, 0, bytes);
+}
+
+// Determine how full the table is in permille, by sampling the first HASHFULL_CLUSTERS clusters.
+int
+HashFull()
+{
+  int i, j, used = 0;
+
+  for(i = 0; i < HASHFULL_CLUSTERS; i++) {
+    for(j = 0; j < TRANS_CLUSTER_SIZE; j++) {
+      if(clusters[i].Data[j].Key32) {
+        used++;
+      }
+    }
+  }
+
+  return used*1000/(HASHFULL_CLUSTERS*TRANS_CLUSTER_SIZE);
+}
+
+// Allocate the default table, unless a table has already been sized explicitly.
 void
 InitTrans()
 {
-  ResizeTrans(DEFAULT_SIZE_MB);
+  if(clusters == NULL) {
+    ResizeTrans(DEFAULT_SIZE_MB);
+  }
 }
 
-TransEntry*
-LookupPosition(uint64_t key)
+// Look up the specified key, copying its entry into ret if found. Entries may be written by other
+// threads while we read them, so we take a copy and verify it against its check bits - a torn
+// entry simply looks like a miss.
+bool
+LookupPosition(uint64_t key, TransEntry *ret)
 {
   int i;
+  TransEntry copy;
   TransEntry *entry = firstEntry(key);
   uint32_t innerKey = key >> 32;
 
   for(i = 0; i < TRANS_CLUSTER_SIZE; i++, entry++) {
-    if(entry->Key32 == innerKey) {
-      return entry;
+    copy = *entry;
+
+    if((copy.Key32^entryCheck(&copy)) == innerKey) {
+      *ret = copy;
+      ret->Key32 = innerKey;
+
+      return true;
     }
   }
 
-  return NULL;
+  return false;
 }
 
 void
 NextSearchTrans()
 {
-  // We use generation to determine which entries relate to our current search or not.
-  generation++;
+  // We use generation to determine which entries relate to our current search or not. The low
+  // bits of the generation byte are the bound, so step over them.
+  generation += GENERATION_STEP;
+}
+
+// Hint that we will soon look up the specified key, so its cluster is hopefully in cache by the
+// time we do.
+void
+PrefetchTrans(uint64_t key)
+{
+  __builtin_prefetch(firstEntry(key));
 }
 
 void
 ResizeTrans(uint64_t sizeMb)
 {
-  uint64_t size;
+  // Cluster indexes are derived from 32 bits of the key, so we can't use more than 2^32 clusters.
+  uint64_t size = sizeMb*C64(1024)*C64(1024)/sizeof(TransCluster);
 
-  // We want size to be a multiple of 2, minimum 1kb.
-  size = 1024;
-  while(C64(2) * size * sizeof(TransCluster) <= (sizeMb * C64(1024) * C64(1024))) {
-    size *= 2;
+  if(size < MIN_CLUSTERS) {
+    size = MIN_CLUSTERS;
+  } else if(size > C64(1)<<32) {
+    size = C64(1)<<32;
   }
 
   // Nothing to do if resizing to same size.
-  if(size == transSize) {
+  if(size == transSize && hugePages == clustersHuge) {
     return;
   }
 
   if(clusters != NULL) {
-    release(clusters);
+    releaseLarge(clusters, clustersLength);
   }
 
   transSize = size;
-  clusters = allocateZero(sizeof(TransCluster), transSize);
+  clustersHuge = hugePages;
+  clusters = allocateLarge(sizeof(TransCluster)*transSize, hugePages, &clustersLength);
+
+  if(clusters == NULL) {
+    panic("Unable to allocate %lu MB transposition table.", sizeMb);
+  }
+
+  // The memory is already zeroed, but we want to fault it in now rather than on first use.
+  ClearTrans();
 }
 
 void
-SavePosition(uint64_t key, int value, QuickMove quickMove, uint16_t depth)
+SavePosition(uint64_t key, int64_t value, QuickMove quickMove, uint8_t depth, Bound bound)
 {
   int i, weight;
   TransEntry *entry, *replaceee;
@@ -99,8 +199,8 @@ SavePosition(uint64_t key, int value, QuickMove quickMove, uint16_t depth)
   uint32_t innerKey = key >> 32;
 
   for(i = 0; i < TRANS_CLUSTER_SIZE; i++, entry++) {
-    if(!entry->Key32 || entry->Key32 == innerKey) {
-      saveEntry(entry, depth, generation, innerKey, quickMove, value);
+    if(!entry->Key32 || (entry->Key32^entryCheck(entry)) == innerKey) {
+      saveEntry(entry, depth, generation|bound, innerKey, quickMove, value);
 
       return;
     }
@@ -111,8 +211,8 @@ SavePosition(uint64_t key, int value, QuickMove quickMove, uint16_t depth)
     // Again we are mimicking Stockfish's approach here :-)
 
     // We give major weighting to entries which are from the same search.
-    weight =  replaceee->Generation == generation ? 2 : 0;
-    weight += entry->Generation == generation ? -2 : 0;
+    weight =  (replaceee->GenBound&~BOUND_MASK) == generation ? 2 : 0;
+    weight += (entry->GenBound&~BOUND_MASK) == generation ? -2 : 0;
     // Otherwise, our main differentiator is depth.
     weight += entry->Depth < replaceee->Depth ? 1 : 0;
 
@@ -122,29 +222,62 @@ SavePosition(uint64_t key, int value, QuickMove quickMove, uint16_t depth)
   }
 
   // If we get here, then we're going to have to replace.
-  saveEntry(replaceee, depth, generation, innerKey, quickMove, value);
+  saveEntry(replaceee, depth, generation|bound, innerKey, quickMove, value);
 }
 
+// Determine whether the transposition table should be backed by huge pages. Applied on the next
+// resize.
 void
-UpdateGeneration(TransEntry *entry)
+UseHugePages(bool use)
+{
+  hugePages = use;
+}
+
+// Number of entries in the table.
+uint64_t
+TransEntries()
+{
+  return transSize*TRANS_CLUSTER_SIZE;
+}
+
+static void*
+clearSlice(void *arg)
+{
+  ClearSlice *slice = (ClearSlice*)arg;
+
+  memset(slice->Start, 0, slice->Count*sizeof(TransCluster));
+
+  return NULL;
+}
+
+// Fold an entry's data into 32 bits. We store the key xor this, so an entry whose data and key
+// were written by different threads fails to match.
+static FORCE_INLINE uint32_t
+entryCheck(TransEntry *entry)
 {
-  entry->Generation = generation;
+  return (uint32_t)entry->Value ^ (uint32_t)(entry->Value >> 32) ^
+    ((uint32_t)entry->QuickMove | (uint32_t)entry->Depth << 16 | (uint32_t)entry->GenBound << 24);
 }
 
 static FORCE_INLINE
 TransEntry* firstEntry(uint64_t key)
 {
-  // Use low 32 bits of key to determine the cluster.
-  return clusters[((uint32_t)key) & (transSize-1)].Data;
+  // Use low 32 bits of key to determine the cluster. Rather than masking, which requires a
+  // power of 2 table size, we scale them to [0, transSize) so any size can be used.
+  return clusters[((uint64_t)(uint32_t)key*transSize) >> 32].Data;
 }
 
 static void
-saveEntry(TransEntry *entry, uint16_t depth, uint8_t gen, uint32_t key32,
-          QuickMove quickMove, int value)
+saveEntry(TransEntry *entry, uint8_t depth, uint8_t genBound, uint32_t key32,
+          QuickMove quickMove, int64_t value)
 {
-  entry->Depth = depth;
-  entry->Generation = gen;
-  entry->Key32 = key32;
-  entry->QuickMove = quickMove;
-  entry->Value = value;
+  TransEntry ret;
+
+  ret.Depth = depth;
+  ret.GenBound = genBound;
+  ret.QuickMove = quickMove;
+  ret.Value = value;
+  ret.Key32 = key32^entryCheck(&ret);
+
+  *entry = ret;
 }
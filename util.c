@@ -23,13 +23,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 #include "weak.h"
 
 // We violate naming convention here for familiarity-with-go's sake. :-) TODO: Fix.
 
-#define INIT_BUILDER_SIZE 10
+#define INIT_BUILDER_SIZE 256
 
-static void        expandBuilder(StringBuilder*);
+// Output() collects output here, writing it with a single fwrite() when full or flushed.
+#define OUTPUT_BUFFER_SIZE (1<<16)
+
+#define HUGE_PAGE_SIZE (C64(2)*1024*1024)
+
+static char   outputBuffer[OUTPUT_BUFFER_SIZE];
+static size_t outputLength = 0;
+
+static void        expandBuilder(StringBuilder*, int);
 static ListNode*   newListNode(List*, ListNode*, ListNode*, void*);
 static PackedMoves newPackedMoves(void);
 
@@ -46,6 +56,50 @@ allocateZero(size_t size, size_t num)
   return calloc(num, size);
 }
 
+// Allocate a large, zeroed, huge page-aligned block of memory, e.g. for the transposition table.
+// Release with releaseLarge(), passing the size returned in *actualSize.
+//
+// If hugePages is set we try explicitly reserved huge pages first, falling back to asking for
+// transparent huge pages. Otherwise we explicitly ask for normal pages. Returns NULL on failure.
+void*
+allocateLarge(size_t size, bool hugePages, size_t *actualSize)
+{
+  char *aligned, *ret;
+  size_t head, tail;
+
+  size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  *actualSize = size;
+
+  if(hugePages) {
+    ret = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if(ret != MAP_FAILED) {
+      return ret;
+    }
+  }
+
+  // Over-allocate so we can align to a huge page boundary, which transparent huge pages need.
+  ret = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(ret == MAP_FAILED) {
+    return NULL;
+  }
+
+  aligned = (char*)(((uintptr_t)ret + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+  head = aligned - ret;
+  tail = HUGE_PAGE_SIZE - head;
+
+  if(head > 0) {
+    munmap(ret, head);
+  }
+  if(tail > 0) {
+    munmap(aligned + size, tail);
+  }
+
+  // This is only advice, so failure isn't fatal.
+  madvise(aligned, size, hugePages ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+
+  return aligned;
+}
+
 void
 panic(char *msg, ...)
 {
@@ -74,63 +128,136 @@ release(void *ptr)
 }
 
 void
-AppendString(StringBuilder *builder, char *str, ...)
+releaseLarge(void *ptr, size_t size)
 {
-  char buffer[APPEND_STRING_BUFFER_LENGTH];
-  int strLen;
-  va_list args;
+  munmap(ptr, size);
+}
 
-  if(builder->cap < builder->len) {
-    panic("Impossible.");
-  }
-  if(builder->cap == builder->len) {
-    expandBuilder(builder);
-  }
+// Add a*b to a 128-bit count.
+void
+AddProductUint128(Uint128 *count, uint64_t a, uint64_t b)
+{
+  uint64_t aHi = a>>32, aLo = a&0xffffffff, bHi = b>>32, bLo = b&0xffffffff;
+  uint64_t cross1 = aHi*bLo, cross2 = aLo*bHi, lo = aLo*bLo;
+  // Sum of the middle 32-bit column, which can't overflow.
+  uint64_t middle = (lo>>32) + (cross1&0xffffffff) + (cross2&0xffffffff);
 
-  va_start(args, str);
+  count->Hi += aHi*bHi + (cross1>>32) + (cross2>>32) + (middle>>32);
+  AddUint128(count, (middle<<32) | (lo&0xffffffff));
+}
 
-  vsprintf(buffer, str, args);
+// Add n to a 128-bit count.
+void
+AddUint128(Uint128 *count, uint64_t n)
+{
+  count->Lo += n;
+  // Wrapped around.
+  if(count->Lo < n) {
+    count->Hi++;
+  }
+}
+
+// Format a string onto the end of the builder.
+void
+AppendString(StringBuilder *builder, char *str, ...)
+{
+  int len;
+  va_list args;
 
+  va_start(args, str);
+  len = vsnprintf(builder->buffer + builder->Length, builder->cap - builder->Length, str, args);
   va_end(args);
 
-  strLen = strlen(buffer);
+  // If it didn't fit, make room and format it again.
+  if(builder->Length + len >= builder->cap) {
+    expandBuilder(builder, builder->Length + len + 1);
 
-  builder->strings[builder->len] = strdup(buffer);
-  builder->len++;
+    va_start(args, str);
+    vsprintf(builder->buffer + builder->Length, str, args);
+    va_end(args);
+  }
 
-  builder->Length += strLen;
+  builder->Length += len;
 }
 
+// Return the builder's string, or NULL if it's empty. If releaseBuilder is set, the builder's
+// buffer is returned rather than copied.
 char*
 BuildString(StringBuilder *builder, bool releaseBuilder)
 {
   char *ret;
-  int i, j, k;
-
-  char *str;
 
   if(builder->Length <= 0) {
+    if(releaseBuilder) {
+      ReleaseStringBuilder(builder);
+    }
+
     return NULL;
   }
 
-  ret = (char*)allocate(sizeof(char), builder->Length + 1);
+  if(releaseBuilder) {
+    ret = builder->buffer;
+    builder->buffer = NULL;
+  } else {
+    ret = (char*)allocate(sizeof(char), builder->Length + 1);
+    memcpy(ret, builder->buffer, builder->Length + 1);
+  }
 
-  k = 0;
-  for(i = 0; i < builder->len && k < builder->Length; i++) {
-    str = builder->strings[i];
-    for(j = 0; str[j] != '\0'; j++) {
-      ret[k] = str[j];
-      k++;
-    }
+  return ret;
+}
+
+// Determine whether the processor supports AVX2.
+bool
+CpuHasAvx2()
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+  __builtin_cpu_init();
+
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+// Write any output collected by Output().
+void
+FlushOutput()
+{
+  if(outputLength > 0) {
+    fwrite(outputBuffer, 1, outputLength, stdout);
+    outputLength = 0;
   }
 
-  ret[k] = '\0';
+  fflush(stdout);
+}
+
+// Write count in decimal to str, which must have room for UINT128_DECIMAL_LEN characters. Returns
+// the length written, excluding the terminating null.
+int
+FormatUint128(Uint128 count, char *str)
+{
+  char digits[UINT128_DECIMAL_LEN];
+  int i, len = 0;
+  // Most significant first, 32 bits each so that long division by 10 fits in 64 bits.
+  uint64_t limbs[4] = { count.Hi>>32, count.Hi&0xffffffff, count.Lo>>32, count.Lo&0xffffffff };
+  uint64_t curr, rem;
+
+  do {
+    rem = 0;
+    for(i = 0; i < 4; i++) {
+      curr = (rem<<32) | limbs[i];
+      limbs[i] = curr/10;
+      rem = curr%10;
+    }
+    digits[len++] = '0' + rem;
+  } while(limbs[0] | limbs[1] | limbs[2] | limbs[3]);
 
-  if(releaseBuilder) {
-    ReleaseStringBuilder(builder);
+  for(i = 0; i < len; i++) {
+    str[i] = digits[len - 1 - i];
   }
+  str[len] = '\0';
 
-  return ret;
+  return len;
 }
 
 int
@@ -139,6 +266,17 @@ Max(int a, int b)
   return a >= b ? a : b;
 }
 
+// Nanoseconds elapsed on a monotonic clock since some arbitrary point.
+uint64_t
+NanoTime()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return C64(1000000000)*now.tv_sec + now.tv_nsec;
+}
+
 List*
 NewList()
 {
@@ -157,14 +295,32 @@ NewStringBuilder()
   StringBuilder ret;
 
   ret.Length = 0;
-
   ret.cap = INIT_BUILDER_SIZE;
-  ret.len = 0;
-  ret.strings = (char**)allocate(sizeof(char*), INIT_BUILDER_SIZE);
+  ret.buffer = (char*)allocate(sizeof(char), INIT_BUILDER_SIZE);
+  ret.buffer[0] = '\0';
 
   return ret;
 }
 
+// Write output via a buffer, so printing many short strings costs a single fwrite() per
+// OUTPUT_BUFFER_SIZE characters. Call FlushOutput() before any other output to stdout. Not
+// thread safe.
+void
+Output(const char *str, size_t len)
+{
+  if(outputLength + len > OUTPUT_BUFFER_SIZE) {
+    FlushOutput();
+
+    if(len > OUTPUT_BUFFER_SIZE) {
+      fwrite(str, 1, len, stdout);
+      return;
+    }
+  }
+
+  memcpy(outputBuffer + outputLength, str, len);
+  outputLength += len;
+}
+
 PackedMoves
 PackMoveHistory(MemorySlice *history, int offset)
 {
@@ -292,11 +448,9 @@ PushBack(List *list, void *item)
 void
 ReleaseStringBuilder(StringBuilder *builder)
 {
-  int i;
-
-  for(i = 0; i < builder->len; i++) {
-    release(builder->strings[i]);
-  }
+  release(builder->buffer);
+  builder->buffer = NULL;
+  builder->Length = builder->cap = 0;
 }
 
 // Set stdout output unbuffered.
@@ -334,16 +488,20 @@ UnpackMoveHistory(PackedMoves* packed, bool releasePackedMoves)
   return ret;
 }
 
+// Grow the builder's buffer to hold at least cap characters.
 static void
-expandBuilder(StringBuilder *builder)
+expandBuilder(StringBuilder *builder, int cap)
 {
-  char **buffer;
+  char *buffer;
+
+  while(builder->cap < cap) {
+    builder->cap *= 2;
+  }
 
-  builder->cap *= 2;
-  buffer = (char**)allocate(sizeof(char*), builder->cap);
-  memcpy(buffer, builder->strings, builder->len*sizeof(char*));
-  release(builder->strings);
-  builder->strings = buffer;
+  buffer = (char*)allocate(sizeof(char), builder->cap);
+  memcpy(buffer, builder->buffer, builder->Length + 1);
+  release(builder->buffer);
+  builder->buffer = buffer;
 }
 
 static ListNode*
@@ -0,0 +1,5 @@
+#include "weak.h"
+
+// DO NOT EDIT MANUALLY: Generated from script.
+
+const char *version = "";
@@ -30,6 +30,13 @@
 #include <stdlib.h>
 
 #define USE_BITSCAN_ASM
+// Use AVX2 kernels where the processor supports it, see SlidingAttacks() and CountMovesBatch().
+#define USE_AVX2
+#define USE_THREAD
+
+// Uncomment (or build with make profile) to count node types, move list lengths, DoMove paths
+// and CheckStats usage, printed by --profile. Costs nothing when off.
+//#define PROFILE
 
 // See http://chessprogramming.wikispaces.com/Bitboards.
 #define C64(constantU64) constantU64##ULL
@@ -41,10 +48,24 @@
 
 #define FORCE_INLINE inline __attribute__((always_inline))
 #define PACKED __attribute__((packed))
+#define CACHE_LINE_SIZE 64
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE_SIZE)))
+
+// Fails to compile if cond is false.
+#define STATIC_ASSERT(cond, name) typedef char static_assert_##name[(cond) ? 1 : -1]
 
-#define APPEND_STRING_BUFFER_LENGTH 2000
 #define INIT_MOVE_LEN 192
 #define KISS_WARMUP_ROUNDS 100
+// Longest FEN WriteFen() can produce, including the terminating null.
+#define MAX_FEN_LEN 128
+// Buffer sizes required by FormatMove(), FormatMoveFull() and FormatPosition().
+#define FORMAT_MOVE_LEN      8
+#define FORMAT_MOVE_FULL_LEN 9
+#define FORMAT_POSITION_LEN  3
+// Deepest frontier CollectFrontier() can collect.
+#define MAX_FRONTIER_DEPTH 8
+// Longest decimal FormatUint128() can produce, including the terminating null.
+#define UINT128_DECIMAL_LEN 40
 #define MAX_PIECE_LOCATION 10
 
 #define BIG   (INT_MAX-1)
@@ -52,6 +73,11 @@
 
 #define MAX_THINK_SECS 1
 
+// Score of being checkmated at the root. Scores beyond MATE_BOUND are mates within MAX_PLY.
+#define MAX_PLY    64
+#define MATE       100000
+#define MATE_BOUND (MATE-MAX_PLY)
+
 #define TRANS_CLUSTER_SIZE 4
 
 /*
@@ -80,6 +106,45 @@ Type    3 size = 4
 #define FROM(move)    ((Position)( ((move)>>6)&(MOVE_MASK(6))))
 #define TYPE(move)    ((MoveType)(((move)>>12)&(MOVE_MASK(4))))
 
+// CheckStats fields which are calculated on first use, see CheckStats.Stale.
+enum CheckStatsField {
+  CheckSquaresField,
+  DiscoveredField,
+  PinnedField,
+  ThreatsField,
+  CheckStatsFieldCount
+};
+
+#define STALE_FIELD(field) (1<<(field))
+
+// Which of DoMove()'s paths a move takes, for profiling.
+enum DoMovePath {
+  QuietPath,
+  DoublePushPath,
+  CapturePath,
+  EnPassantPath,
+  CastleKingSidePath,
+  CastleQueenSidePath,
+  PromotionPath,
+  CapturePromotionPath,
+  DoMovePathCount
+};
+#define ALL_STALE_FIELDS   (STALE_FIELD(CheckStatsFieldCount)-1)
+
+// Transposition entries share a byte between the bound and the search generation - the bound
+// occupies the low 2 bits. Search and HashPerft() share the table, so perft node counts are
+// stored with PerftBound, which search never cuts off on, and HashPerft() only reads entries
+// with that bound.
+enum Bound {
+  PerftBound,
+  UpperBound,
+  LowerBound,
+  ExactBound
+};
+
+#define BOUND_MASK      3
+#define GENERATION_STEP 4
+
 enum CastleEvent {
   NoCastleEvent      = 0,
   LostKingSideWhite  = 1 << 0,
@@ -93,6 +158,25 @@ enum CastleSide {
   QueenSide
 };
 
+// Why CheckpointPerft() couldn't use a checkpoint, see StringCheckpointError().
+enum CheckpointError {
+  CheckpointOk,
+  CheckpointMismatch,
+  CheckpointUnwritable
+};
+
+// Why ParseFenInto() rejected a FEN, see StringFenError().
+enum FenError {
+  FenOk,
+  FenInvalidPlacement,
+  FenInvalidSide,
+  FenInvalidCastling,
+  FenInvalidEnPassant,
+  FenInvalidClock,
+  FenInvalidPosition,
+  FenTrailingCharacters
+};
+
 enum File {
   FileA = 0,
   FileB = 1,
@@ -190,10 +274,18 @@ extern const char *version;
 // A bitboard is an efficient representation of the occupancy of a chessboard [0].
 // We use little-endian rank-file (LERF) mapping [1].
 typedef uint64_t             BitBoard;
+typedef enum Bound           Bound;
 typedef enum CastleEvent     CastleEvent;
 typedef enum CastleSide      CastleSide;
+typedef enum CheckpointError CheckpointError;
+typedef enum CheckStatsField CheckStatsField;
 typedef struct CheckStats    CheckStats;
 typedef struct ChessSet      ChessSet;
+typedef enum DoMovePath      DoMovePath;
+typedef enum FenError        FenError;
+typedef struct Frontier      Frontier;
+typedef struct FrontierEntry FrontierEntry;
+typedef struct FrontierStats FrontierStats;
 typedef struct PackedMoves   PackedMoves;
 typedef struct Game          Game;
 typedef struct List          List;
@@ -205,19 +297,30 @@ typedef uint16_t             Move;
 typedef struct MoveSlice     MoveSlice;
 typedef enum MoveType        MoveType;
 typedef struct PerftStats    PerftStats;
+typedef struct Profile       Profile;
+typedef struct SearchLimits  SearchLimits;
 typedef enum Piece           Piece;
 typedef enum Position        Position;
 typedef enum Rank            Rank;
+typedef struct ResumeStats   ResumeStats;
 typedef enum File            File;
 typedef struct Set           Set;
 typedef enum Side            Side;
 typedef struct StringBuilder StringBuilder;
 typedef struct TransCluster  TransCluster;
 typedef struct TransEntry    TransEntry;
+typedef struct Uint128       Uint128;
 
+// CheckSources and the king positions are always up to date. The remaining fields are only
+// valid once calculated, which we do on first use via the accessors below - STALE_FIELD() bits
+// in Stale indicate which still need calculating.
 struct CheckStats {
   BitBoard CheckSquares[7], CheckSources, Discovered, Pinned;
+  // Squares attacked by the opposing side, with our king removed from the occupancy so sliders
+  // 'see through' it.
+  BitBoard Threats;
   Position DefendedKing, AttackedKing;
+  int      Stale;
 };
 
 struct PackedMoves {
@@ -237,7 +340,7 @@ struct ListNode {
 };
 
 struct MemorySlice {
-  Memory *Vals, *Curr;
+  Memory *Vals, *Curr, *End;
 };
 
 struct MoveSlice {
@@ -253,6 +356,9 @@ struct Memory {
   CastleEvent CastleEvent;
   CheckStats  CheckStats;
   Position    EnPassantSquare;
+  // Hash and halfmove clock of the position before the move.
+  uint64_t    Hash;
+  int         HalfMoveClock;
   Move        Move;
   Piece       Captured;
 };
@@ -273,8 +379,14 @@ struct Game {
   ChessSet    ChessSet;
   bool        Debug;
   Position    EnPassantSquare;
+  // Plies since the last capture or pawn move, for the fifty move rule.
+  int         HalfMoveClock;
+  // Starts at 1, incremented after each black move.
+  int         FullMoveNumber;
   uint64_t    Hash;
   MemorySlice Memories;
+  // Material and piece-square score from white's point of view, see PieceSquareScores.
+  int         Score;
   Side        WhosTurn, HumanSide;
 };
 
@@ -282,25 +394,103 @@ struct PerftStats {
   uint64_t Count, Captures, EnPassants, Castles, Promotions, Checks, Checkmates;
 };
 
+// A distinct position at the frontier, with the moves along one of the paths to it from the root.
+struct FrontierEntry {
+  uint64_t Hash, Multiplicity;
+  Move     Moves[MAX_FRONTIER_DEPTH];
+};
+
+// What CheckpointPerft() did with its checkpoint. Resumed of its Subtrees were already counted
+// there, or Error says why it couldn't be used.
+struct ResumeStats {
+  CheckpointError Error;
+  int             Resumed, Subtrees;
+};
+
+// The size of the frontier DistributedPerft() or UniquePerft() split the tree at. Count is 0 if
+// they didn't split.
+struct FrontierStats {
+  int      Count, Depth;
+  uint64_t Positions;
+};
+
+// The distinct positions a fixed number of plies from a root, see CollectFrontier().
+struct Frontier {
+  FrontierEntry *Entries;
+  int            Count, Depth;
+  // Positions including duplicates, i.e. the perft of the root to Depth.
+  uint64_t       Positions;
+
+  // Open addressing index from hash to entry, -1 where empty.
+  int           *slots;
+  uint64_t       mask;
+  int            cap;
+};
+
+// Unsigned 128-bit count, for node totals of very deep perfts. See AddUint128().
+struct Uint128 {
+  uint64_t Hi, Lo;
+};
+
+// Counters collected when PROFILE is defined. Not synchronised, so only meaningful for
+// single-threaded runs.
+struct Profile {
+  // Positions AllMoves() generated evasions and non-evasions for, and how many pseudo-legal moves
+  // were generated and then rejected as illegal.
+  uint64_t EvasionNodes, NonEvasionNodes, PseudoLegalMoves, PseudoLegalRejected;
+  // Histogram of perft legal move list lengths, one bucket per length.
+  uint64_t MoveCounts[INIT_MOVE_LEN + 1];
+  uint64_t DoMovePaths[DoMovePathCount], DoMoveChecks;
+  // Number of times each CheckStats field was calculated and consumed, and the number of
+  // positions for which CheckStats were required.
+  uint64_t CheckStatsCalculated[CheckStatsFieldCount];
+  uint64_t CheckStatsConsumed[CheckStatsFieldCount];
+  uint64_t CheckStatsPositions;
+};
+
+#if defined(PROFILE)
+extern Profile Profiling;
+
+#define PROFILE_ADD(counter, n) (Profiling.counter += (n))
+#else
+#define PROFILE_ADD(counter, n)
+#endif
+#define PROFILE_COUNT(counter) PROFILE_ADD(counter, 1)
+
+// Limits on a search - it stops when any is reached. A zero limit is ignored, though there must be
+// at least one. Node and time limits are enforced by a monitor thread.
+struct SearchLimits {
+  int      Depth;
+  uint64_t Nodes, Millis;
+};
+
 struct StringBuilder {
   // Length is the total number of characters in the builder.
   int Length;
-  // cap, len refer to the capacity/length of the number of strings in the builder.
-  int cap, len;
-  char **strings;
+  // The characters are accumulated in a single buffer of cap characters, which always has room
+  // for the terminating null.
+  int cap;
+  char *buffer;
 };
 
+// Value holds either a search score or, for perft, a subtree node count. In the table, Key32 is
+// stored xor the other fields, see LookupPosition().
 struct TransEntry {
-  uint16_t Depth;
-  uint8_t  Generation;
   uint32_t Key32;
   uint16_t QuickMove;
-  int      Value;
+  uint8_t  Depth;
+  uint8_t  GenBound;
+  int64_t  Value;
 };
 
+// A cluster occupies exactly 1 cache line, so a probe costs at most 1 cache miss.
 struct TransCluster {
   TransEntry Data[TRANS_CLUSTER_SIZE];
-};
+} CACHE_ALIGNED;
+
+STATIC_ASSERT(sizeof(TransEntry) == 16, trans_entry_size);
+STATIC_ASSERT(sizeof(TransCluster) == CACHE_LINE_SIZE, trans_cluster_size);
+STATIC_ASSERT(__alignof__(TransCluster) == CACHE_LINE_SIZE, trans_cluster_alignment);
 
 static const BitBoard
   CastlingAttackMasks[2][2]      = {{ C64(0x0000000000000060), C64(0x000000000000000c) },
@@ -363,9 +553,16 @@ static const BitBoard
 BitBoard nortRays[64], eastRays[64], soutRays[64], westRays[64],
   noeaRays[64], soweRays[64], noweRays[64], soeaRays[64];
 
+// slices.c - used in inlined function, hence location.
+void ExpandMemorySlice(MemorySlice*);
+
 FORCE_INLINE void
 AppendMemory(MemorySlice *slice, Memory memory)
 {
+  if(slice->Curr == slice->End) {
+    ExpandMemorySlice(slice);
+  }
+
   *slice->Curr++ = memory;
 }
 
@@ -567,6 +764,42 @@ SoWeRay(Position pos)
   return soweRays[pos];
 }
 
+// Squares attacked along one direction by a set of sliders, via a Kogge-Stone occluded fill
+// towards lower squares. The wrap mask clears squares the shift would wrap onto. See [11].
+static FORCE_INLINE BitBoard
+FillAttacksDown(BitBoard gen, BitBoard empty, int shift, BitBoard wrap)
+{
+  BitBoard pro = empty & wrap;
+
+  gen |= pro & (gen >> shift);
+  pro &= pro >> shift;
+  gen |= pro & (gen >> 2*shift);
+  pro &= pro >> 2*shift;
+  gen |= pro & (gen >> 4*shift);
+
+  // The fill stops short of blockers, so take one more step.
+  return (gen >> shift) & wrap;
+}
+
+// As FillAttacksDown(), towards higher squares.
+static FORCE_INLINE BitBoard
+FillAttacksUp(BitBoard gen, BitBoard empty, int shift, BitBoard wrap)
+{
+  BitBoard pro = empty & wrap;
+
+  gen |= pro & (gen << shift);
+  pro &= pro << shift;
+  gen |= pro & (gen << 2*shift);
+  pro &= pro << 2*shift;
+  gen |= pro & (gen << 4*shift);
+
+  return (gen << shift) & wrap;
+}
+
+// batch.c
+void CountMovesBatch(Game**, int, uint32_t*);
+bool InitCountMovesBatch(bool);
+
 // bitboard.c
 bool     Aligned(Position, Position, Position);
 BitBoard FlipDiagA1H8(BitBoard);
@@ -577,10 +810,33 @@ bool     PositionOccupied(BitBoard, Position);
 BitBoard Rotate90AntiClockwise(BitBoard);
 BitBoard Rotate90Clockwise(BitBoard);
 
+// distributed.c
+bool DistributedPerft(Game*, int, int, int, char*, bool, Uint128*, FrontierStats*);
+void PerftWorker(int, int, bool);
+
+// eval.c
+int  Evaluate(Game*);
+void InitEval(void);
+int  ScoreGame(Game*);
+int  See(Game*, Move);
+
+// fill.c
+bool     InitSlidingAttacks(bool);
+BitBoard SlidingAttacks(BitBoard, BitBoard, BitBoard);
+BitBoard SlidingAttacksScalar(BitBoard, BitBoard, BitBoard);
+
+// frontier.c
+Frontier CollectFrontier(Game*, int);
+void     PlayFrontierEntry(Game*, Frontier*, int);
+void     ReleaseFrontier(Frontier*);
+
 // game.c
 CheckStats CalculateCheckStats(Game*);
+void       CalculateCheckStatsField(Game*, CheckStatsField);
 bool       Checked(Game*);
 bool       Checkmated(Game*);
+Game       CopyGame(Game*);
+bool       FiftyMoveDraw(Game*);
 bool       GivesCheck(Game*, Move);
 void       InitEngine(void);
 void       DoMove(Game*, Move);
@@ -589,10 +845,13 @@ CheckStats NewCheckStats(void);
 Game       NewEmptyGame(bool, Side);
 Game       NewGame(bool, Side);
 bool       PseudoLegal(Game*, Move, BitBoard);
+void       ReleaseGame(Game*);
+bool       Repeated(Game*);
 bool       Stalemated(Game*);
 void       Unmove(Game*);
 
 // hash.c
+uint64_t HashAfter(Game*, Move);
 uint64_t HashGame(Game*);
 void     InitZobrist(void);
 
@@ -607,15 +866,23 @@ Move* CastleMoves(Game*, Move*);
 Move* Evasions(Move*, Game*);
 
 // parser.c
-Game    ParseFen(char*);
-Move    ParseMove(char*);
+void     InitParser(void);
+Game     ParseFen(char*);
+FenError ParseFenInto(Game*, const char*, size_t);
+Move     ParseMove(char*);
 
 // perft.c
+bool       CheckpointPerft(Game*, int, int, bool, char*, Uint128*, ResumeStats*);
+uint64_t   DividePerft(Game*, int, bool);
+uint64_t   HashPerft(Game*, int, bool);
+uint64_t   ParallelPerft(Game*, int, int, bool, uint64_t*);
 PerftStats Perft(Game*, int);
 uint64_t   QuickPerft(Game*, int);
+void       UniquePerft(Game*, int, int, int, bool, Uint128*, FrontierStats*);
 
 // pieces.c
 BitBoard AllAttackersTo(ChessSet*, Position, BitBoard);
+BitBoard AllAttacksFrom(ChessSet*, Side, BitBoard);
 BitBoard BishopAttacksFrom(Position, BitBoard);
 BitBoard CalcBishopSquareThreats(Position, BitBoard);
 BitBoard CalcRookSquareThreats(Position, BitBoard);
@@ -626,11 +893,22 @@ BitBoard KingAttacksFrom(Position);
 BitBoard KnightAttacksFrom(Position);
 BitBoard PawnAttacksFrom(Position, Side);
 
+// profile.c
+void PrintProfile(void);
+
 // prng.c
 uint64_t randk(void);
 void     randk_seed(void);
 void     randk_warmup(int);
 
+// search.c
+SearchLimits DefaultSearchLimits(void);
+Move         Search(Game*, uint64_t*, int*, int);
+Move         SearchLimited(Game*, SearchLimits*, uint64_t*, int*, int);
+Move         SearchThreads(Game*, uint64_t*, int*, int, int);
+void         UseHistoryOrdering(bool);
+void         UseSeePruning(bool);
+
 // set.c
 Set      NewBlackSet(void);
 ChessSet NewChessSet(void);
@@ -641,13 +919,20 @@ BitBoard PinnedPieces(ChessSet*, Side, Position, bool);
 void     UpdateOccupancies(ChessSet*);
 
 // slices.c
+MemorySlice CopyMemorySlice(MemorySlice*);
 MemorySlice NewMemorySlice(void);
 MoveSlice   NewMoveSlice(Move*);
+void        ReleaseMemorySlice(MemorySlice*);
 
 // stringer.c
 char  CharPiece(Piece);
+int   FormatMove(Move, char*);
+int   FormatMoveFull(Move, Piece, bool, char*);
+int   FormatPosition(Position, char*);
 char* StringBitBoard(BitBoard);
+char* StringCheckpointError(CheckpointError);
 char* StringChessSet(ChessSet*);
+char* StringFenError(FenError);
 char* StringMove(Move);
 char* StringMoveFull(Move, Piece, bool);
 char* StringMoveHistory(MemorySlice*, bool);
@@ -655,30 +940,47 @@ char* StringPerft(PerftStats*);
 char* StringPiece(Piece);
 char* StringPosition(Position);
 char* StringSide(Side);
+int   WriteFen(Game*, char*);
 
 #ifdef USE_THREAD
 // thread.c
+int  CpuCount(void);
 bool CreateThread(void *(*thread)(void*), void *);
+int  FetchAdd(volatile int*, int);
+bool RunThreads(int, void *(*)(void*), void*, size_t);
 #endif
 
 // trans.c
+void        ClearTrans(void);
+int         HashFull(void);
 void        InitTrans(void);
-TransEntry* LookupPosition(uint64_t);
+bool        LookupPosition(uint64_t, TransEntry*);
 void        NextSearchTrans(void);
+void        PrefetchTrans(uint64_t);
 void        ResizeTrans(uint64_t);
-void        SavePosition(uint64_t, int, QuickMove, uint16_t);
-void        UpdateGeneration(TransEntry*);
+void        SavePosition(uint64_t, int64_t, QuickMove, uint8_t, Bound);
+uint64_t    TransEntries(void);
+void        UseHugePages(bool);
 
 // util.c
 void*         allocate(size_t, size_t);
+void*         allocateLarge(size_t, bool, size_t*);
 void*         allocateZero(size_t, size_t);
 void          release(void*);
+void          releaseLarge(void*, size_t);
 void          panic(char*, ...);
+void          AddProductUint128(Uint128*, uint64_t, uint64_t);
+void          AddUint128(Uint128*, uint64_t);
 void          AppendString(StringBuilder *, char*, ...);
 char*         BuildString(StringBuilder*, bool);
+bool          CpuHasAvx2(void);
+void          FlushOutput(void);
+int           FormatUint128(Uint128, char*);
 int           Max(int, int);
+uint64_t      NanoTime(void);
 List*         NewList(void);
 StringBuilder NewStringBuilder(void);
+void          Output(const char*, size_t);
 PackedMoves   PackMoveHistory(MemorySlice*, int);
 void*         PopBack(List*);
 void*         PopFront(List*);
@@ -688,6 +990,53 @@ void          ReleaseStringBuilder(StringBuilder*);
 void          SetUnbufferedOutput(void);
 Move*         UnpackMoveHistory(PackedMoves*, bool);
 
+// Ensure the specified CheckStats field is up to date.
+static FORCE_INLINE void
+freshenCheckStats(Game *game, CheckStatsField field)
+{
+  PROFILE_COUNT(CheckStatsConsumed[field]);
+
+  if(game->CheckStats.Stale&STALE_FIELD(field)) {
+    CalculateCheckStatsField(game, field);
+  }
+}
+
+// Squares from which the specified piece of ours would attack the opposing king.
+static FORCE_INLINE BitBoard
+CheckSquares(Game *game, Piece piece)
+{
+  freshenCheckStats(game, CheckSquaresField);
+
+  return game->CheckStats.CheckSquares[piece];
+}
+
+// Our pieces which, were they to move, might reveal a check on the opposing king.
+static FORCE_INLINE BitBoard
+Discovered(Game *game)
+{
+  freshenCheckStats(game, DiscoveredField);
+
+  return game->CheckStats.Discovered;
+}
+
+// Our pieces pinned against our king.
+static FORCE_INLINE BitBoard
+Pinned(Game *game)
+{
+  freshenCheckStats(game, PinnedField);
+
+  return game->CheckStats.Pinned;
+}
+
+// Squares attacked by the side not to move.
+static FORCE_INLINE BitBoard
+Threats(Game *game)
+{
+  freshenCheckStats(game, ThreatsField);
+
+  return game->CheckStats.Threats;
+}
+
 // Array containing BitBoard of positions between two specified squares, as long as
 // they are on the same rank/file/diagonal. This is exclusive of the from and to squares.
 BitBoard Between[64][64];
@@ -708,4 +1057,8 @@ uint64_t ZobristEnPassantFileHash[8];
 uint64_t ZobristPositionHash[2][7][64];
 uint64_t ZobristBlackHash;
 
+// Contribution of each piece on each square to Game.Score - positive for white, negative for
+// black.
+int PieceSquareScores[2][7][64];
+
 #endif